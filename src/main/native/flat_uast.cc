@@ -0,0 +1,405 @@
+#include "flat_uast.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+// FlatWriter appends nodes in the flat layout, interning all the strings.
+class FlatWriter {
+ private:
+  std::vector<char> out;
+  std::vector<const std::string *> strings;
+  std::unordered_map<std::string, int32_t> stringIds;
+
+  template <typename T>
+  void put(T v) {
+    const char *p = reinterpret_cast<const char *>(&v);
+    out.insert(out.end(), p, p + sizeof(T));
+  }
+
+  int32_t intern(const std::string &s) {
+    auto it = stringIds.find(s);
+    if (it != stringIds.end()) return it->second;
+
+    int32_t id = int32_t(strings.size());
+    auto res = stringIds.emplace(s, id);
+    strings.push_back(&res.first->first);
+    return id;
+  }
+
+  static int8_t kindOf(NodeKind kind) {
+    switch (kind) {
+      case NODE_OBJECT:
+        return JNODE_KIND_OBJECT;
+      case NODE_ARRAY:
+        return JNODE_KIND_ARRAY;
+      case NODE_STRING:
+        return JNODE_KIND_STRING;
+      case NODE_INT:
+        return JNODE_KIND_INT;
+      case NODE_UINT:
+        return JNODE_KIND_UINT;
+      case NODE_FLOAT:
+        return JNODE_KIND_FLOAT;
+      case NODE_BOOL:
+        return JNODE_KIND_BOOL;
+      default:
+        return JNODE_KIND_NULL;
+    }
+  }
+
+ public:
+  // Write appends the node and its children, up to the given depth.
+  void Write(FlatNode *node, int depth) {
+    if (!node) {
+      put<int8_t>(JNODE_KIND_NULL);
+      return;
+    }
+
+    NodeKind kind = node->Kind();
+    if (depth == 0 && (kind == NODE_OBJECT || kind == NODE_ARRAY)) {
+      put<int8_t>(FLAT_REF);
+      put<int8_t>(kindOf(kind));
+      put<int64_t>(reinterpret_cast<int64_t>(node));
+      return;
+    }
+
+    put<int8_t>(kindOf(kind));
+    switch (kind) {
+      case NODE_OBJECT: {
+        size_t sz = node->Size();
+        put<int32_t>(int32_t(sz));
+        for (size_t i = 0; i < sz; i++) {
+          std::string *k = node->KeyAt(i);
+          put<int32_t>(intern(*k));
+          delete k;
+          Write(node->ValueAt(i), depth - 1);
+        }
+        break;
+      }
+      case NODE_ARRAY: {
+        size_t sz = node->Size();
+        put<int32_t>(int32_t(sz));
+        for (size_t i = 0; i < sz; i++) {
+          Write(node->ValueAt(i), depth - 1);
+        }
+        break;
+      }
+      case NODE_STRING: {
+        std::string *s = node->AsString();
+        put<int32_t>(intern(*s));
+        delete s;
+        break;
+      }
+      case NODE_INT:
+        put<int64_t>(node->AsInt());
+        break;
+      case NODE_UINT:
+        put<uint64_t>(node->AsUint());
+        break;
+      case NODE_FLOAT:
+        put<double>(node->AsFloat());
+        break;
+      case NODE_BOOL:
+        put<int8_t>(node->AsBool() ? 1 : 0);
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Finish returns the string table followed by all the written nodes.
+  std::vector<char> Finish() {
+    size_t total = sizeof(int32_t) + out.size();
+    for (const std::string *s : strings) {
+      total += sizeof(int32_t) + s->size();
+    }
+
+    std::vector<char> res;
+    res.reserve(total);
+    out.swap(res);
+
+    put<int32_t>(int32_t(strings.size()));
+    for (const std::string *s : strings) {
+      put<int32_t>(int32_t(s->size()));
+      out.insert(out.end(), s->begin(), s->end());
+    }
+    out.insert(out.end(), res.begin(), res.end());
+    return std::move(out);
+  }
+};
+
+// Max nesting of objects and arrays read by FlatReader. Reading recurses
+// once per level, on the stack of a JVM thread.
+const int MAX_FLAT_DEPTH = 2048;
+
+// FlatReader reads nodes in the flat layout, checking all the bounds.
+class FlatReader {
+ private:
+  const char *cur;
+  const char *end;
+  std::vector<std::string> strings;
+  int depth;
+
+  template <typename T>
+  T get() {
+    if (size_t(end - cur) < sizeof(T)) {
+      throw std::runtime_error("unexpected end of the flat UAST");
+    }
+    T v;
+    memcpy(&v, cur, sizeof(T));
+    cur += sizeof(T);
+    return v;
+  }
+
+  size_t getSize() {
+    int32_t sz = get<int32_t>();
+    if (sz < 0) throw std::runtime_error("negative size in the flat UAST");
+    return size_t(sz);
+  }
+
+  // getCount reads a number of entries, that take at least minSize bytes
+  // each, and checks that they fit in the rest of the data before anything
+  // is allocated for them.
+  size_t getCount(size_t minSize) {
+    size_t n = getSize();
+    if (n > size_t(end - cur) / minSize) {
+      throw std::runtime_error("size is out of the bounds of the flat UAST");
+    }
+    return n;
+  }
+
+  // Nested counts a level of nesting for its lifetime, and fails once it is
+  // too deep.
+  class Nested {
+   private:
+    FlatReader *r;
+
+   public:
+    explicit Nested(FlatReader *reader) : r(reader) {
+      if (++r->depth > MAX_FLAT_DEPTH) {
+        r->depth--;
+        throw std::runtime_error("flat UAST is nested too deep");
+      }
+    }
+    ~Nested() { r->depth--; }
+  };
+
+  const std::string &getString() {
+    int32_t id = get<int32_t>();
+    if (id < 0 || size_t(id) >= strings.size()) {
+      throw std::runtime_error("invalid string id in the flat UAST");
+    }
+    return strings[id];
+  }
+
+ public:
+  FlatReader(const char *data, size_t len)
+      : cur(data), end(data + len), depth(0) {
+    // int32 length
+    size_t n = getCount(4);
+    strings.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      size_t sz = getSize();
+      if (size_t(end - cur) < sz) {
+        throw std::runtime_error("unexpected end of the flat UAST");
+      }
+      strings.emplace_back(cur, sz);
+      cur += sz;
+    }
+  }
+
+  FlatNode *Read(FlatTree *tree) {
+    switch (get<int8_t>()) {
+      case JNODE_KIND_NULL:
+        return nullptr;
+      case JNODE_KIND_OBJECT: {
+        // int32 key id and int8 kind
+        size_t sz = getCount(5);
+        Nested nested(this);
+        FlatNode *obj = tree->NewObject(sz);
+        for (size_t i = 0; i < sz; i++) {
+          const std::string &k = getString();
+          obj->SetKeyValue(k, Read(tree));
+        }
+        return obj;
+      }
+      case JNODE_KIND_ARRAY: {
+        // int8 kind
+        size_t sz = getCount(1);
+        Nested nested(this);
+        FlatNode *arr = tree->NewArray(sz);
+        for (size_t i = 0; i < sz; i++) {
+          arr->SetValue(i, Read(tree));
+        }
+        return arr;
+      }
+      case JNODE_KIND_STRING:
+        return tree->NewString(getString());
+      case JNODE_KIND_INT:
+        return tree->NewInt(get<int64_t>());
+      case JNODE_KIND_UINT:
+        return tree->NewUint(get<uint64_t>());
+      case JNODE_KIND_FLOAT:
+        return tree->NewFloat(get<double>());
+      case JNODE_KIND_BOOL:
+        return tree->NewBool(get<int8_t>() != 0);
+      default:
+        throw std::runtime_error("unknown node kind in the flat UAST");
+    }
+  }
+};
+}  // namespace
+
+std::vector<char> FlatTree::Serialize(FlatNode *root, int depth) {
+  FlatWriter w;
+  // the root itself is never written as a reference
+  w.Write(root, depth < 0 ? -1 : depth + 1);
+  return w.Finish();
+}
+
+FlatNode *FlatTree::Parse(const char *data, size_t len) {
+  FlatReader r(data, len);
+  return r.Read(this);
+}
+
+void CountBy(FlatNode *root, const std::string &field,
+             std::unordered_map<std::string, int64_t> *counts) {
+  std::vector<FlatNode *> stack;
+  if (root) stack.push_back(root);
+
+  while (!stack.empty()) {
+    FlatNode *node = stack.back();
+    stack.pop_back();
+
+    NodeKind kind = node->Kind();
+    if (kind != NODE_OBJECT && kind != NODE_ARRAY) continue;
+
+    size_t sz = node->Size();
+    for (size_t i = 0; i < sz; i++) {
+      FlatNode *v = node->ValueAt(i);
+      if (!v) continue;
+      stack.push_back(v);
+
+      if (kind != NODE_OBJECT || node->Key(i) != field) continue;
+      if (v->Kind() == NODE_STRING) {
+        (*counts)[v->Str()]++;
+      } else if (v->Kind() == NODE_ARRAY) {
+        for (size_t j = 0; j < v->Size(); j++) {
+          FlatNode *e = v->ValueAt(j);
+          if (e && e->Kind() == NODE_STRING) (*counts)[e->Str()]++;
+        }
+      }
+    }
+  }
+}
+
+int32_t Columns::Intern(const std::string &s) {
+  auto it = stringIds.find(s);
+  if (it != stringIds.end()) return it->second;
+
+  // offsets are int32, the same as the size of a JVM buffer
+  if (s.size() > size_t(INT32_MAX) - stringData.size()) {
+    throw std::runtime_error("UAST strings do not fit in 2 GiB of columns");
+  }
+
+  int32_t id = int32_t(stringIds.size());
+  stringIds.emplace(s, id);
+  stringData.insert(stringData.end(), s.begin(), s.end());
+  ints[COL_STRING_OFFSETS].push_back(int32_t(stringData.size()));
+  return id;
+}
+
+namespace {
+// Returns the value of a given key of an object, or null.
+FlatNode *field(FlatNode *obj, const char *key) {
+  if (!obj || obj->Kind() != NODE_OBJECT) return nullptr;
+  for (size_t i = 0; i < obj->Size(); i++) {
+    if (obj->Key(i) == key) return obj->ValueAt(i);
+  }
+  return nullptr;
+}
+
+// Returns an integer value as int32, or -1 if it is absent.
+int32_t intValue(FlatNode *node) {
+  if (!node) return -1;
+  switch (node->Kind()) {
+    case NODE_INT:
+      return int32_t(node->AsInt());
+    case NODE_UINT:
+      return int32_t(node->AsUint());
+    default:
+      return -1;
+  }
+}
+
+// Returns the dictionary id of a string value, or -1 if it is absent.
+int32_t stringId(Columns *cols, FlatNode *node) {
+  if (!node || node->Kind() != NODE_STRING) return -1;
+  return cols->Intern(node->Str());
+}
+
+// Appends a row for a given UAST node.
+void appendRow(Columns *cols, FlatNode *node, int32_t parent, int32_t depth) {
+  cols->ints[COL_PARENT].push_back(parent);
+  cols->ints[COL_DEPTH].push_back(depth);
+  cols->ints[COL_TYPE].push_back(stringId(cols, field(node, "@type")));
+  cols->ints[COL_TOKEN].push_back(stringId(cols, field(node, "@token")));
+
+  FlatNode *pos = field(node, "@pos");
+  FlatNode *start = field(pos, "start");
+  FlatNode *end = field(pos, "end");
+  cols->ints[COL_START_OFFSET].push_back(intValue(field(start, "offset")));
+  cols->ints[COL_END_OFFSET].push_back(intValue(field(end, "offset")));
+  cols->ints[COL_START_LINE].push_back(intValue(field(start, "line")));
+  cols->ints[COL_START_COL].push_back(intValue(field(start, "col")));
+  cols->ints[COL_END_LINE].push_back(intValue(field(end, "line")));
+  cols->ints[COL_END_COL].push_back(intValue(field(end, "col")));
+
+  std::vector<int32_t> &roles = cols->ints[COL_ROLES];
+  FlatNode *role = field(node, "@role");
+  if (role && role->Kind() == NODE_ARRAY) {
+    for (size_t i = 0; i < role->Size(); i++) {
+      int32_t id = stringId(cols, role->ValueAt(i));
+      if (id >= 0) roles.push_back(id);
+    }
+  }
+  cols->ints[COL_ROLE_OFFSETS].push_back(int32_t(roles.size()));
+}
+}  // namespace
+
+void ToColumns(FlatNode *root, Columns *cols) {
+  struct Item {
+    FlatNode *node;
+    int32_t parent;
+    int32_t depth;
+  };
+  std::vector<Item> stack;
+  if (root) stack.push_back({root, -1, 0});
+
+  while (!stack.empty()) {
+    Item it = stack.back();
+    stack.pop_back();
+
+    FlatNode *node = it.node;
+    NodeKind kind = node->Kind();
+    if (kind != NODE_OBJECT && kind != NODE_ARRAY) continue;
+
+    // objects with no @type and arrays are transparent
+    int32_t parent = it.parent;
+    int32_t depth = it.depth;
+    if (kind == NODE_OBJECT && field(node, "@type")) {
+      appendRow(cols, node, it.parent, it.depth);
+      parent = cols->Rows() - 1;
+      depth = it.depth + 1;
+    }
+
+    // children are pushed in reverse, to be visited in order
+    for (size_t i = node->Size(); i-- > 0;) {
+      FlatNode *v = node->ValueAt(i);
+      if (!v) continue;
+      if (kind == NODE_OBJECT && node->Key(i) == "@pos") continue;
+      stack.push_back({v, parent, depth});
+    }
+  }
+}
@@ -0,0 +1,257 @@
+#ifndef _Included_org_bblfsh_client_libuast_Libuast_flat_uast
+#define _Included_org_bblfsh_client_libuast_Libuast_flat_uast
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "libuast.h"
+#include "libuast.hpp"
+
+// Kinds of JVM nodes, as exposed by JNode.kind.
+// Must be kept in sync with JNode.Kind on the Scala side.
+enum JNodeKind {
+  JNODE_KIND_NULL = 0,
+  JNODE_KIND_OBJECT = 1,
+  JNODE_KIND_ARRAY = 2,
+  JNODE_KIND_STRING = 3,
+  JNODE_KIND_INT = 4,
+  JNODE_KIND_UINT = 5,
+  JNODE_KIND_FLOAT = 6,
+  JNODE_KIND_BOOL = 7,
+};
+
+// Flat binary layout of a UAST, that is exchanged with the JVM in a single
+// JNI call. Must be kept in sync with JNode.readFlat and JNode.writeFlat on
+// the Scala side.
+//
+// All numbers are in native byte order:
+//
+//   int32    number of strings
+//   strings  int32 length followed by UTF-8 bytes, for each string
+//   nodes    in pre-order, int8 JNodeKind followed by
+//              NULL:       nothing
+//              OBJECT:     int32 size, then size x (int32 key id, node)
+//              ARRAY:      int32 size, then size x node
+//              STRING:     int32 string id
+//              INT, UINT:  int64
+//              FLOAT:      float64
+//              BOOL:       int8
+//              REF:        int8 JNodeKind, int64 FlatNode pointer
+//
+// Strings (both keys and values) are deduplicated and referenced by their
+// index in the string table. Objects and arrays deeper than the requested
+// depth are written as references to native nodes, that are not expanded.
+
+// Kind of a reference to a native node in the flat layout.
+const int8_t FLAT_REF = 8;
+
+// FlatNode is a plain native UAST node, that never calls into the JVM.
+class FlatNode : public uast::Node<FlatNode *> {
+ private:
+  NodeKind kind;
+  std::string str;
+  union {
+    int64_t i;
+    uint64_t u;
+    double f;
+    bool b;
+  } scalar;
+  std::vector<std::string> keys;
+  std::vector<FlatNode *> values;
+
+ public:
+  friend class FlatTree;
+
+  explicit FlatNode(NodeKind k) : kind(k) { scalar.u = 0; }
+
+  NodeKind Kind() { return kind; }
+  std::string *AsString() { return new std::string(str); }  // new ref
+  int64_t AsInt() { return scalar.i; }
+  uint64_t AsUint() { return scalar.u; }
+  double AsFloat() { return scalar.f; }
+  bool AsBool() { return scalar.b; }
+  size_t Size() {
+    if (kind == NODE_STRING) return str.size();
+    return values.size();
+  }
+  std::string *KeyAt(size_t i) {  // new ref
+    if (i >= keys.size()) return nullptr;
+    return new std::string(keys[i]);
+  }
+  // Borrows the reference
+  FlatNode *ValueAt(size_t i) {
+    if (i >= values.size()) return nullptr;
+    return values[i];
+  }
+
+  // Borrowed views of the string value and the keys, that do not copy them.
+  const std::string &Str() const { return str; }
+  const std::string &Key(size_t i) const { return keys[i]; }
+
+  void SetValue(size_t i, FlatNode *val) {
+    if (i >= values.size()) values.resize(i + 1, nullptr);
+    values[i] = val;
+  }
+  void SetKeyValue(std::string key, FlatNode *val) {
+    keys.push_back(std::move(key));
+    values.push_back(val);
+  }
+};
+
+// FlatTree creates and owns FlatNodes, and converts them from and to the
+// flat binary layout.
+class FlatTree : public uast::NodeCreator<FlatNode *> {
+ private:
+  std::deque<FlatNode> nodes;
+
+  FlatNode *create(NodeKind kind) {
+    nodes.emplace_back(kind);
+    return &nodes.back();
+  }
+
+ public:
+  // Serialize writes the tree under a given root in the flat layout.
+  //
+  // If depth is not negative, objects and arrays that are deeper than depth
+  // levels below the root are written as references.
+  std::vector<char> Serialize(FlatNode *root, int depth = -1);
+
+  // Parse reads a tree in the flat layout and returns its root.
+  // Throws std::runtime_error if the data is malformed.
+  FlatNode *Parse(const char *data, size_t len);
+
+  // abstract methods from NodeCreator
+  FlatNode *NewObject(size_t size) {
+    FlatNode *n = create(NODE_OBJECT);
+    n->keys.reserve(size);
+    n->values.reserve(size);
+    return n;
+  }
+  FlatNode *NewArray(size_t size) {
+    FlatNode *n = create(NODE_ARRAY);
+    n->values.resize(size, nullptr);
+    return n;
+  }
+  FlatNode *NewString(std::string v) {
+    FlatNode *n = create(NODE_STRING);
+    n->str = std::move(v);
+    return n;
+  }
+  FlatNode *NewInt(int64_t v) {
+    FlatNode *n = create(NODE_INT);
+    n->scalar.i = v;
+    return n;
+  }
+  FlatNode *NewUint(uint64_t v) {
+    FlatNode *n = create(NODE_UINT);
+    n->scalar.u = v;
+    return n;
+  }
+  FlatNode *NewFloat(double v) {
+    FlatNode *n = create(NODE_FLOAT);
+    n->scalar.f = v;
+    return n;
+  }
+  FlatNode *NewBool(bool v) {
+    FlatNode *n = create(NODE_BOOL);
+    n->scalar.b = v;
+    return n;
+  }
+};
+
+// CountBy counts the values of a given field in all the objects of the tree
+// under root. String values are counted as is, and arrays (like @role) count
+// each of their string elements.
+void CountBy(FlatNode *root, const std::string &field,
+             std::unordered_map<std::string, int64_t> *counts);
+
+// Columns of the columnar (struct-of-arrays) copy of a UAST.
+// Must be kept in sync with UastColumns on the Scala side.
+//
+// There is one row per UAST node (an object with @type) in pre-order. Nodes
+// under @pos are folded into the position columns of their owner. Absent
+// values are -1, there are no validity bitmaps. All strings are ids in a
+// single dictionary.
+//
+// All columns but the string data are int32 in native byte order. Roles are
+// offsets (rows + 1 of them) into the role ids, and the dictionary is
+// offsets (strings + 1 of them) into the string data. Each column is at most
+// 2 GiB, larger trees fail.
+enum ColumnId {
+  COL_PARENT = 0,  // row of the parent node, -1 for the root
+  COL_DEPTH,
+  COL_TYPE,
+  COL_TOKEN,
+  COL_START_OFFSET,
+  COL_END_OFFSET,
+  COL_START_LINE,
+  COL_START_COL,
+  COL_END_LINE,
+  COL_END_COL,
+  COL_ROLE_OFFSETS,
+  COL_ROLES,
+  COL_STRING_OFFSETS,
+  COL_STRING_DATA,  // UTF-8 bytes
+  NUM_COLUMNS,
+};
+
+class Columns {
+ private:
+  std::unordered_map<std::string, int32_t> stringIds;
+
+ public:
+  // int32 columns, indexed by ColumnId
+  std::vector<int32_t> ints[COL_STRING_DATA];
+  std::vector<char> stringData;
+
+  Columns() {
+    ints[COL_ROLE_OFFSETS].push_back(0);
+    ints[COL_STRING_OFFSETS].push_back(0);
+  }
+
+  int32_t Rows() const { return int32_t(ints[COL_PARENT].size()); }
+
+  // Intern returns the dictionary id of a given string.
+  int32_t Intern(const std::string &s);
+
+  // Pointer to the data of a given column, and its size in bytes.
+  const void *Data(ColumnId col) const {
+    if (col == COL_STRING_DATA) return stringData.data();
+    return ints[col].data();
+  }
+  size_t Bytes(ColumnId col) const {
+    if (col == COL_STRING_DATA) return stringData.size();
+    return ints[col].size() * sizeof(int32_t);
+  }
+};
+
+// ToColumns appends the tree under root to the columns, in a single
+// pre-order traversal.
+void ToColumns(FlatNode *root, Columns *cols);
+
+// FlatContext is a UAST context over native FlatNodes.
+class FlatContext {
+ private:
+  FlatTree *tree;
+  uast::PtrInterface<FlatNode *> *impl;
+  uast::Context<FlatNode *> *ctx;
+
+ public:
+  FlatContext() {
+    tree = new FlatTree();
+    impl = new uast::PtrInterface<FlatNode *>(tree);
+    ctx = impl->NewContext();
+  }
+  ~FlatContext() {
+    delete (ctx);
+    delete (impl);
+    delete (tree);
+  }
+
+  FlatTree *Tree() { return tree; }
+  uast::Context<FlatNode *> *Ctx() { return ctx; }
+};
+#endif
@@ -1,36 +1,69 @@
 #include "jni_utils.h"
+#include <pthread.h>
 #include <string>
 
 // TODO(bzz): double-check and document. Suggestion and more context at
 // https://github.com/bblfsh/scala-client/pull/84#discussion_r288347756
 extern JavaVM *jvm;
 
+namespace {
+// Under threadEnvKey, the JNIEnv of a native thread that getJNIEnv()
+// attached to the JVM. Threads started by the JVM have no value there.
+//
+// Only a pointer owned by the JVM is stored, so nothing leaks when the key
+// is deleted by JNI_OnUnload without running the destructor.
+pthread_key_t threadEnvKey;
+
+// Detaches a thread attached by getJNIEnv() from the JVM when it exits.
+// Local references of an attached thread are only freed when it detaches.
+void detachThread(void *) {
+  if (jvm) {
+    jvm->DetachCurrentThread();
+  }
+}
+}  // namespace
+
+bool createThreadEnvKey() {
+  return pthread_key_create(&threadEnvKey, detachThread) == 0;
+}
+
+void deleteThreadEnvKey() { pthread_key_delete(threadEnvKey); }
+
 JNIEnv *getJNIEnv() {
-  JNIEnv *pEnv = NULL;
+  auto attachedEnv = static_cast<JNIEnv *>(pthread_getspecific(threadEnvKey));
+  if (attachedEnv) return attachedEnv;
 
+  JNIEnv *pEnv = NULL;
   switch (jvm->GetEnv((void **)&pEnv, JNI_VERSION_1_8)) {
     case JNI_OK:  // Thread is ready to use, nothing to do
-      break;
+      return pEnv;
 
     case JNI_EDETACHED:  // Thread is detached, need to attach
-      jvm->AttachCurrentThread((void **)&pEnv, NULL);
-      // FIXME(bzz): this is a memory leak (at least)
-      //  - jvm->DetachCurrentThread() is never called
-      //  - local references are _never_ deleted :scream:
-      //    https://developer.android.com/training/articles/perf-jni#local-and-global-references
-      break;
+      if (jvm->AttachCurrentThread((void **)&pEnv, NULL) != JNI_OK) {
+        return NULL;
+      }
+      pthread_setspecific(threadEnvKey, pEnv);
+      return pEnv;
+
+    default:
+      return NULL;
   }
-
-  return pEnv;
 }
 
 // Class fully qualified names
 const char CLS_NODE[] = "org/bblfsh/client/v2/NodeExt";
 const char CLS_CTX_EXT[] = "org/bblfsh/client/v2/ContextExt";
 const char CLS_CTX[] = "org/bblfsh/client/v2/Context";
+const char CLS_LAZY_CTX[] = "org/bblfsh/client/v2/LazyContext";
+const char CLS_QUERY[] = "org/bblfsh/client/v2/PreparedQuery";
+const char CLS_LONG_ARR[] = "[J";
 const char CLS_TO[] = "org/bblfsh/client/v2/libuast/Libuast$TreeOrder";
 const char CLS_ENCS[] = "org/bblfsh/client/v2/libuast/Libuast$UastFormat";
 const char CLS_OBJ[] = "java/lang/Object";
+const char CLS_STR[] = "java/lang/String";
+const char CLS_SYS[] = "java/lang/System";
+const char CLS_BUF_POOL[] = "org/bblfsh/client/v2/BufferPool";
+const char CLS_SINK[] = "org/bblfsh/client/v2/ChunkSink";
 const char CLS_RE[] = "java/lang/RuntimeException";
 const char CLS_JNODE[] = "org/bblfsh/client/v2/JNode";
 const char CLS_JNULL[] = "org/bblfsh/client/v2/JNull";
@@ -41,6 +74,8 @@ const char CLS_JBOOL[] = "org/bblfsh/client/v2/JBool";
 const char CLS_JUINT[] = "org/bblfsh/client/v2/JUint";
 const char CLS_JARR[] = "org/bblfsh/client/v2/JArray";
 const char CLS_JOBJ[] = "org/bblfsh/client/v2/JObject";
+const char CLS_ABS_ITER[] =
+    "org/bblfsh/client/v2/libuast/Libuast$UastAbstractIter";
 const char CLS_ITER[] = "org/bblfsh/client/v2/libuast/Libuast$UastIterExt";
 const char CLS_JITER[] = "org/bblfsh/client/v2/libuast/Libuast$UastIter";
 
@@ -48,10 +83,8 @@ const char CLS_JITER[] = "org/bblfsh/client/v2/libuast/Libuast$UastIter";
 const char METHOD_JNODE_KEY_AT[] = "(I)Ljava/lang/String;";
 const char METHOD_JNODE_VALUE_AT[] = "(I)Lorg/bblfsh/client/v2/JNode;";
 const char METHOD_JOBJ_ADD[] =
-    "(Ljava/lang/String;Lorg/bblfsh/client/v2/JNode;)Lscala/collection/"
-    "mutable/Buffer;";
-const char METHOD_JARR_ADD[] =
-    "(Lorg/bblfsh/client/v2/JNode;)Lscala/collection/mutable/Buffer;";
+    "(Ljava/lang/String;Lorg/bblfsh/client/v2/JNode;)V";
+const char METHOD_JARR_ADD[] = "(Lorg/bblfsh/client/v2/JNode;)V";
 
 const char METHOD_OBJ_TO_STR[] = "()Ljava/lang/String;";
 
@@ -69,28 +102,232 @@ const char FIELD_ITER_NODE[] = "Ljava/lang/Object;";
 const char FIELD_CTX[] = "Lorg/bblfsh/client/v2/Context;";
 const char FIELD_CTX_EXT[] = "Lorg/bblfsh/client/v2/ContextExt;";
 
-// TODO(#114): cache classes&methods in JNI_OnLoad should speed this up
+// Cached classes
+JClass CLASS_NODE = {CLS_NODE, nullptr};
+JClass CLASS_CTX_EXT = {CLS_CTX_EXT, nullptr};
+JClass CLASS_CTX = {CLS_CTX, nullptr};
+JClass CLASS_LAZY_CTX = {CLS_LAZY_CTX, nullptr};
+JClass CLASS_QUERY = {CLS_QUERY, nullptr};
+JClass CLASS_LONG_ARR = {CLS_LONG_ARR, nullptr};
+JClass CLASS_OBJ = {CLS_OBJ, nullptr};
+JClass CLASS_STR = {CLS_STR, nullptr};
+JClass CLASS_SYS = {CLS_SYS, nullptr};
+JClass CLASS_BUF_POOL = {CLS_BUF_POOL, nullptr};
+JClass CLASS_SINK = {CLS_SINK, nullptr};
+JClass CLASS_RE = {CLS_RE, nullptr};
+JClass CLASS_TO = {CLS_TO, nullptr};
+JClass CLASS_ENCS = {CLS_ENCS, nullptr};
+JClass CLASS_JNODE = {CLS_JNODE, nullptr};
+JClass CLASS_JNULL = {CLS_JNULL, nullptr};
+JClass CLASS_JSTR = {CLS_JSTR, nullptr};
+JClass CLASS_JINT = {CLS_JINT, nullptr};
+JClass CLASS_JFLT = {CLS_JFLT, nullptr};
+JClass CLASS_JBOOL = {CLS_JBOOL, nullptr};
+JClass CLASS_JUINT = {CLS_JUINT, nullptr};
+JClass CLASS_JARR = {CLS_JARR, nullptr};
+JClass CLASS_JOBJ = {CLS_JOBJ, nullptr};
+JClass CLASS_ABS_ITER = {CLS_ABS_ITER, nullptr};
+JClass CLASS_ITER = {CLS_ITER, nullptr};
+JClass CLASS_JITER = {CLS_JITER, nullptr};
+
+// Cached constructors
+JMethod INIT_NODE = {&CLASS_NODE, "<init>", METHOD_NODE_INIT, nullptr};
+JMethod INIT_CTX_EXT = {&CLASS_CTX_EXT, "<init>", "(J)V", nullptr};
+JMethod INIT_CTX = {&CLASS_CTX, "<init>", "(J)V", nullptr};
+JMethod INIT_LAZY_CTX = {&CLASS_LAZY_CTX, "<init>", "(J)V", nullptr};
+JMethod INIT_TO = {&CLASS_TO, "<init>", "(IIIIII)V", nullptr};
+JMethod INIT_ENCS = {&CLASS_ENCS, "<init>", "(II)V", nullptr};
+JMethod INIT_RE = {&CLASS_RE, "<init>", METHOD_RE_INIT, nullptr};
+JMethod INIT_RE_CAUSE = {&CLASS_RE, "<init>", METHOD_RE_INIT_CAUSE, nullptr};
+JMethod INIT_ITER = {&CLASS_ITER, "<init>", METHOD_ITER_INIT, nullptr};
+JMethod INIT_JITER = {&CLASS_JITER, "<init>", METHOD_JITER_INIT, nullptr};
+JMethod INIT_JNULL = {&CLASS_JNULL, "<init>", "()V", nullptr};
+JMethod INIT_JSTR = {&CLASS_JSTR, "<init>", "(Ljava/lang/String;)V", nullptr};
+JMethod INIT_JINT = {&CLASS_JINT, "<init>", "(J)V", nullptr};
+JMethod INIT_JFLT = {&CLASS_JFLT, "<init>", "(D)V", nullptr};
+JMethod INIT_JBOOL = {&CLASS_JBOOL, "<init>", "(Z)V", nullptr};
+JMethod INIT_JUINT = {&CLASS_JUINT, "<init>", "(J)V", nullptr};
+JMethod INIT_JARR = {&CLASS_JARR, "<init>", "(I)V", nullptr};
+JMethod INIT_JOBJ = {&CLASS_JOBJ, "<init>", "(I)V", nullptr};
+
+// Cached methods
+JMethod MID_OBJ_TO_STR = {&CLASS_OBJ, "toString", METHOD_OBJ_TO_STR, nullptr};
+JMethod MID_JNODE_KIND = {&CLASS_JNODE, "kind", "()I", nullptr};
+JMethod MID_JNODE_SIZE = {&CLASS_JNODE, "size", "()I", nullptr};
+JMethod MID_JNODE_KEY_AT = {&CLASS_JNODE, "keyAt", METHOD_JNODE_KEY_AT,
+                            nullptr};
+JMethod MID_JNODE_VALUE_AT = {&CLASS_JNODE, "valueAt", METHOD_JNODE_VALUE_AT,
+                              nullptr};
+JMethod MID_JSTR_STR = {&CLASS_JSTR, "str", "()Ljava/lang/String;", nullptr};
+JMethod MID_JINT_NUM = {&CLASS_JINT, "num", "()J", nullptr};
+JMethod MID_JFLT_NUM = {&CLASS_JFLT, "num", "()D", nullptr};
+JMethod MID_JBOOL_VALUE = {&CLASS_JBOOL, "value", "()Z", nullptr};
+JMethod MID_JUINT_GET = {&CLASS_JUINT, "get", "()J", nullptr};
+JMethod MID_JOBJ_ADD = {&CLASS_JOBJ, "append", METHOD_JOBJ_ADD, nullptr};
+JMethod MID_JARR_ADD = {&CLASS_JARR, "append", METHOD_JARR_ADD, nullptr};
+JMethod MID_BUF_POOL_ACQUIRE = {&CLASS_BUF_POOL, "acquire",
+                                "(I)Ljava/nio/ByteBuffer;", nullptr};
+JMethod MID_SINK_FLUSH = {&CLASS_SINK, "flush", "(I)V", nullptr};
+
+// Cached static methods
+JMethod MID_SYS_IDENTITY_HASH = {&CLASS_SYS, "identityHashCode",
+                                 "(Ljava/lang/Object;)I", nullptr};
+
+// Cached fields
+JField FID_NODE_CTX = {&CLASS_NODE, "ctx", FIELD_CTX_EXT, nullptr};
+JField FID_NODE_HANDLE = {&CLASS_NODE, "handle", "J", nullptr};
+JField FID_CTX_EXT_NATIVE = {&CLASS_CTX_EXT, "nativeContext", "J", nullptr};
+JField FID_CTX_NATIVE = {&CLASS_CTX, "nativeContext", "J", nullptr};
+JField FID_LAZY_CTX_NATIVE = {&CLASS_LAZY_CTX, "nativeContext", "J",
+                               nullptr};
+JField FID_QUERY_NATIVE = {&CLASS_QUERY, "nativeQuery", "J", nullptr};
+JField FID_SINK_CHUNK = {&CLASS_SINK, "chunk", "Ljava/nio/ByteBuffer;",
+                         nullptr};
+JField FID_ITER_NODE = {&CLASS_ABS_ITER, "node", FIELD_ITER_NODE, nullptr};
+JField FID_ITER_ORDER = {&CLASS_ABS_ITER, "treeOrder", "I", nullptr};
+JField FID_ITER_PTR = {&CLASS_ABS_ITER, "iter", "J", nullptr};
+JField FID_ITER_CTX_EXT = {&CLASS_ITER, "ctx", FIELD_CTX_EXT, nullptr};
+JField FID_JITER_CTX = {&CLASS_JITER, "ctx", FIELD_CTX, nullptr};
+
+static JClass *const cachedClasses[] = {
+    &CLASS_NODE,
+    &CLASS_CTX_EXT,
+    &CLASS_CTX,
+    &CLASS_LAZY_CTX,
+    &CLASS_QUERY,
+    &CLASS_LONG_ARR,
+    &CLASS_OBJ,
+    &CLASS_STR,
+    &CLASS_SYS,
+    &CLASS_BUF_POOL,
+    &CLASS_SINK,
+    &CLASS_RE,
+    &CLASS_TO,
+    &CLASS_ENCS,
+    &CLASS_JNODE,
+    &CLASS_JNULL,
+    &CLASS_JSTR,
+    &CLASS_JINT,
+    &CLASS_JFLT,
+    &CLASS_JBOOL,
+    &CLASS_JUINT,
+    &CLASS_JARR,
+    &CLASS_JOBJ,
+    &CLASS_ABS_ITER,
+    &CLASS_ITER,
+    &CLASS_JITER,
+};
+
+static JMethod *const cachedMethods[] = {
+    &INIT_NODE,
+    &INIT_CTX_EXT,
+    &INIT_CTX,
+    &INIT_LAZY_CTX,
+    &INIT_TO,
+    &INIT_ENCS,
+    &INIT_RE,
+    &INIT_RE_CAUSE,
+    &INIT_ITER,
+    &INIT_JITER,
+    &INIT_JNULL,
+    &INIT_JSTR,
+    &INIT_JINT,
+    &INIT_JFLT,
+    &INIT_JBOOL,
+    &INIT_JUINT,
+    &INIT_JARR,
+    &INIT_JOBJ,
+    &MID_OBJ_TO_STR,
+    &MID_JNODE_KIND,
+    &MID_JNODE_SIZE,
+    &MID_JNODE_KEY_AT,
+    &MID_JNODE_VALUE_AT,
+    &MID_JSTR_STR,
+    &MID_JINT_NUM,
+    &MID_JFLT_NUM,
+    &MID_JBOOL_VALUE,
+    &MID_JUINT_GET,
+    &MID_JOBJ_ADD,
+    &MID_JARR_ADD,
+    &MID_BUF_POOL_ACQUIRE,
+    &MID_SINK_FLUSH,
+};
+
+static JMethod *const cachedStaticMethods[] = {
+    &MID_SYS_IDENTITY_HASH,
+};
+
+static JField *const cachedFields[] = {
+    &FID_NODE_CTX,
+    &FID_NODE_HANDLE,
+    &FID_CTX_EXT_NATIVE,
+    &FID_CTX_NATIVE,
+    &FID_LAZY_CTX_NATIVE,
+    &FID_QUERY_NATIVE,
+    &FID_SINK_CHUNK,
+    &FID_ITER_NODE,
+    &FID_ITER_ORDER,
+    &FID_ITER_PTR,
+    &FID_ITER_CTX_EXT,
+    &FID_JITER_CTX,
+};
+
+bool cacheJNIRefs(JNIEnv *env) {
+  for (JClass *c : cachedClasses) {
+    jclass local = env->FindClass(c->name);
+    if (env->ExceptionCheck() || !local) return false;
+
+    c->ref = (jclass)env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    if (!c->ref) return false;
+  }
+
+  for (JMethod *m : cachedMethods) {
+    m->id = env->GetMethodID(m->cls->ref, m->name, m->signature);
+    if (env->ExceptionCheck() || !m->id) return false;
+  }
+
+  for (JMethod *m : cachedStaticMethods) {
+    m->id = env->GetStaticMethodID(m->cls->ref, m->name, m->signature);
+    if (env->ExceptionCheck() || !m->id) return false;
+  }
+
+  // Note: printing the type from Scala to find the type needed for GetFieldID
+  // third argument using getClass.getName sometimes return objects different
+  // from the ones needed for the signature. To find the right type to use do
+  // this from Scala: (instance).getClass.getDeclaredField("fieldName")
+  for (JField *f : cachedFields) {
+    f->id = env->GetFieldID(f->cls->ref, f->name, f->signature);
+    if (env->ExceptionCheck() || !f->id) return false;
+  }
+
+  return true;
+}
+
+void releaseJNIRefs(JNIEnv *env) {
+  for (JField *f : cachedFields) {
+    f->id = nullptr;
+  }
+  for (JMethod *m : cachedMethods) {
+    m->id = nullptr;
+  }
+  for (JMethod *m : cachedStaticMethods) {
+    m->id = nullptr;
+  }
+  for (JClass *c : cachedClasses) {
+    if (c->ref) env->DeleteGlobalRef(c->ref);
+    c->ref = nullptr;
+  }
+}
+
 void checkJvmException(std::string msg) {
   JNIEnv *env = getJNIEnv();
   auto err = env->ExceptionOccurred();
   if (err) {
     env->ExceptionClear();
 
-    auto exceptionCls = env->FindClass(CLS_RE);
-    if (env->ExceptionCheck() || !exceptionCls) {
-      env->ExceptionClear();
-      env->Throw(env->ExceptionOccurred());
-      return;
-    }
-
-    jmethodID toString =
-        env->GetMethodID(exceptionCls, "toString", METHOD_OBJ_TO_STR);
-    if (env->ExceptionCheck() || !toString) {
-      env->ExceptionClear();
-      env->ThrowNew(exceptionCls,
-                    msg.append(" - failed to find method toString").data());
-      return;
-    }
+    jclass exceptionCls = CLASS_RE.ref;
+    jmethodID toString = MID_OBJ_TO_STR.id;
 
     jstring s = (jstring)env->CallObjectMethod(err, toString);
     if (env->ExceptionCheck() || !s) {
@@ -105,17 +342,7 @@ void checkJvmException(std::string msg) {
     env->ReleaseStringUTFChars(s, utf);
 
     // new RuntimeException(jmsg, err)
-    jmethodID initId =
-        env->GetMethodID(exceptionCls, "<init>", METHOD_RE_INIT_CAUSE);
-    if (env->ExceptionCheck() || !initId) {
-      env->ExceptionClear();
-      env->ThrowNew(exceptionCls,
-                    msg.append(" - failed to get method id for signature ")
-                        .append(METHOD_RE_INIT_CAUSE)
-                        .c_str());
-      return;
-    }
-
+    jmethodID initId = INIT_RE_CAUSE.id;
     jthrowable exception =
         (jthrowable)env->NewObject(exceptionCls, initId, jmsg, err);
     if (env->ExceptionCheck() || !exception) {
@@ -132,140 +359,121 @@ void checkJvmException(std::string msg) {
   }
 }
 
-jobject NewJavaObject(JNIEnv *env, const char *className, const char *initSign,
-                      ...) {
-  jclass cls = env->FindClass(className);
-  checkJvmException(std::string("failed to find a class ").append(className));
-
-  jmethodID initId = env->GetMethodID(cls, "<init>", initSign);
-  checkJvmException(std::string("failed to call a constructor with signature ")
-                        .append(initSign)
-                        .append(" for the class name ")
-                        .append(className));
-
-  va_list varargs;
-  va_start(varargs, initSign);
-  jobject instance = env->NewObjectV(cls, initId, varargs);
-  va_end(varargs);
-  checkJvmException(
-      std::string("failed get varargs for constructor of ").append(className));
-
-  return instance;
+std::string describe(const char *what, const JMethod &m) {
+  return std::string(what)
+      .append(" ")
+      .append(m.cls->name)
+      .append(".")
+      .append(m.name)
+      .append(" using signature ")
+      .append(m.signature);
 }
 
-jfieldID FieldID(JNIEnv *env, jobject obj, const char *field,
-                 const char *typeSignature) {
-  jclass cls = env->GetObjectClass(obj);
-  checkJvmException("failed get the class of an object");
-
-  // Note: printing the type from Scala to find the type needed for GetFieldID
-  // third argument using getClass.getName sometimes return objects different
-  // from the ones needed for the signature. To find the right type to use do
-  // this from Scala: (instance).getClass.getDeclaredField("fieldName")
-  jfieldID fId = env->GetFieldID(cls, field, typeSignature);
-  checkJvmException(std::string("failed get a field ID '")
-                        .append(field)
-                        .append("' for type signature '")
-                        .append(typeSignature)
-                        .append("'"));
-
-  return fId;
+std::string describe(const char *what, const JField &f) {
+  return std::string(what)
+      .append(" '")
+      .append(f.cls->name)
+      .append(".")
+      .append(f.name)
+      .append("' with signature '")
+      .append(f.signature)
+      .append("'");
 }
-jobject ObjectField(JNIEnv *env, jobject obj, const char *name,
-                    const char *signature) {
-  jfieldID fId = FieldID(env, obj, name, signature);
-  if (!fId) {
-    jstring jmsg =
-        env->NewStringUTF(std::string("failed to get field ID for field name '")
-                              .append(name)
-                              .append("' with signature '")
-                              .append(signature)
-                              .append("'")
-                              .c_str());
-    jthrowable re =
-        (jthrowable)NewJavaObject(env, CLS_RE, METHOD_RE_INIT, jmsg);
-    env->Throw(re);
-    return nullptr;
+
+jint IntField(JNIEnv *env, jobject obj, const JField &f) {
+  jint fld = env->GetIntField(obj, f.id);
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed get an Int from field", f));
   }
-  jobject fld = env->GetObjectField(obj, fId);
-  checkJvmException(std::string("failed get an object from field '")
-                        .append(name)
-                        .append("'"));
   return fld;
 }
 
-jint IntField(JNIEnv *env, jobject obj, const char *name,
-              const char *signature) {
-  jfieldID fId = FieldID(env, obj, name, signature);
-  if (!fId) {
-    jstring jmsg =
-        env->NewStringUTF(std::string("failed to get field ID for field name '")
-                              .append(name)
-                              .append("' with signature '")
-                              .append(signature)
-                              .append("'")
-                              .c_str());
-    jthrowable re =
-        (jthrowable)NewJavaObject(env, CLS_RE, METHOD_RE_INIT, jmsg);
-    env->Throw(re);
-    return -1;
+jlong LongField(JNIEnv *env, jobject obj, const JField &f) {
+  jlong fld = env->GetLongField(obj, f.id);
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed get a Long from field", f));
   }
-  jint fld = env->GetIntField(obj, fId);
-  checkJvmException(
-      std::string("failed get an Int from field '").append(name).append("'"));
   return fld;
 }
 
-jmethodID MethodID(JNIEnv *env, const char *method, const char *signature,
-                   const char *className) {
-  jclass cls = env->FindClass(className);
-  checkJvmException(std::string("failed to find a class ").append(className));
+jobject ObjectField(JNIEnv *env, jobject obj, const JField &f) {
+  jobject fld = env->GetObjectField(obj, f.id);
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed get an object from field", f));
+  }
+  return fld;
+}
 
-  jmethodID mId = env->GetMethodID(cls, method, signature);
-  checkJvmException(std::string("failed to get method ")
-                        .append(className)
-                        .append(".")
-                        .append(method));
+void SetObjectField(JNIEnv *env, jobject obj, const JField &f, jobject val) {
+  env->SetObjectField(obj, f.id, val);
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed to set object field", f));
+  }
+}
 
-  return mId;
+jint IntMethod(JNIEnv *env, const JMethod &m, const jobject object, ...) {
+  va_list varargs;
+  va_start(varargs, object);
+  jint res = env->CallIntMethodV(object, m.id, varargs);
+  va_end(varargs);
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed to call method", m));
+  }
+  return res;
 }
 
-jint IntMethod(JNIEnv *env, const char *method, const char *signature,
-               const char *className, const jobject object) {
-  jmethodID mId = MethodID(env, method, signature, className);
-  checkJvmException(std::string("failed to get method ")
-                        .append(className)
-                        .append(".")
-                        .append(method));
-
-  jint res = env->CallIntMethod(object, mId);
-  checkJvmException(std::string("failed to call method ")
-                        .append(className)
-                        .append(".")
-                        .append(method)
-                        .append(" using signature ")
-                        .append(signature));
+jlong LongMethod(JNIEnv *env, const JMethod &m, const jobject object, ...) {
+  va_list varargs;
+  va_start(varargs, object);
+  jlong res = env->CallLongMethodV(object, m.id, varargs);
+  va_end(varargs);
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed to call method", m));
+  }
+  return res;
+}
 
+jdouble DoubleMethod(JNIEnv *env, const JMethod &m, const jobject object, ...) {
+  va_list varargs;
+  va_start(varargs, object);
+  jdouble res = env->CallDoubleMethodV(object, m.id, varargs);
+  va_end(varargs);
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed to call method", m));
+  }
   return res;
 }
 
-jobject ObjectMethod(JNIEnv *env, const char *method, const char *signature,
-                     const char *className, const jobject object, ...) {
-  jmethodID mId = MethodID(env, method, signature, className);
-  checkJvmException(std::string("failed to get method ")
-                        .append(className)
-                        .append(".")
-                        .append(method));
+void VoidMethod(JNIEnv *env, const JMethod &m, const jobject object, ...) {
+  va_list varargs;
+  va_start(varargs, object);
+  env->CallVoidMethodV(object, m.id, varargs);
+  va_end(varargs);
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed to call method", m));
+  }
+}
 
+jboolean BooleanMethod(JNIEnv *env, const JMethod &m, const jobject object,
+                       ...) {
   va_list varargs;
   va_start(varargs, object);
-  jobject res = env->CallObjectMethodV(object, mId, varargs);
+  jboolean res = env->CallBooleanMethodV(object, m.id, varargs);
   va_end(varargs);
-  checkJvmException(std::string("failed to get varargs for ")
-                        .append(className)
-                        .append(".")
-                        .append(method));
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed to call method", m));
+  }
+  return res;
+}
 
+jobject ObjectMethod(JNIEnv *env, const JMethod &m, const jobject object, ...) {
+  va_list varargs;
+  va_start(varargs, object);
+  jobject res = env->CallObjectMethodV(object, m.id, varargs);
+  va_end(varargs);
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed to call method", m));
+  }
   return res;
 }
 
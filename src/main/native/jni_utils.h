@@ -8,8 +8,14 @@
 extern const char CLS_NODE[];
 extern const char CLS_CTX_EXT[];
 extern const char CLS_CTX[];
-extern const char CLS_CTX[];
+extern const char CLS_LAZY_CTX[];
+extern const char CLS_QUERY[];
+extern const char CLS_LONG_ARR[];
 extern const char CLS_OBJ[];
+extern const char CLS_STR[];
+extern const char CLS_SYS[];
+extern const char CLS_BUF_POOL[];
+extern const char CLS_SINK[];
 extern const char CLS_RE[];
 extern const char CLS_TO[];
 extern const char CLS_ENCS[];
@@ -24,6 +30,7 @@ extern const char CLS_JBOOL[];
 extern const char CLS_JUINT[];
 extern const char CLS_JARR[];
 extern const char CLS_JOBJ[];
+extern const char CLS_ABS_ITER[];
 extern const char CLS_ITER[];
 extern const char CLS_JITER[];
 
@@ -43,6 +50,120 @@ extern const char METHOD_NODE_INIT[];
 extern const char FIELD_ITER_NODE[];
 extern const char FIELD_CTX[];
 extern const char FIELD_CTX_EXT[];
+
+// A Java class, pinned by a global reference in JNI_OnLoad.
+struct JClass {
+  const char *name;
+  jclass ref;
+};
+
+// A Java method ID, resolved once in JNI_OnLoad.
+struct JMethod {
+  const JClass *cls;
+  const char *name;
+  const char *signature;
+  jmethodID id;
+};
+
+// A Java field ID, resolved once in JNI_OnLoad.
+struct JField {
+  const JClass *cls;
+  const char *name;
+  const char *signature;
+  jfieldID id;
+};
+
+// Cached classes
+extern JClass CLASS_NODE;
+extern JClass CLASS_CTX_EXT;
+extern JClass CLASS_CTX;
+extern JClass CLASS_LAZY_CTX;
+extern JClass CLASS_QUERY;
+extern JClass CLASS_LONG_ARR;
+extern JClass CLASS_OBJ;
+extern JClass CLASS_STR;
+extern JClass CLASS_SYS;
+extern JClass CLASS_BUF_POOL;
+extern JClass CLASS_SINK;
+extern JClass CLASS_RE;
+extern JClass CLASS_TO;
+extern JClass CLASS_ENCS;
+extern JClass CLASS_JNODE;
+extern JClass CLASS_JNULL;
+extern JClass CLASS_JSTR;
+extern JClass CLASS_JINT;
+extern JClass CLASS_JFLT;
+extern JClass CLASS_JBOOL;
+extern JClass CLASS_JUINT;
+extern JClass CLASS_JARR;
+extern JClass CLASS_JOBJ;
+extern JClass CLASS_ABS_ITER;
+extern JClass CLASS_ITER;
+extern JClass CLASS_JITER;
+
+// Cached constructors
+extern JMethod INIT_NODE;
+extern JMethod INIT_CTX_EXT;
+extern JMethod INIT_CTX;
+extern JMethod INIT_LAZY_CTX;
+extern JMethod INIT_TO;
+extern JMethod INIT_ENCS;
+extern JMethod INIT_RE;
+extern JMethod INIT_RE_CAUSE;
+extern JMethod INIT_ITER;
+extern JMethod INIT_JITER;
+extern JMethod INIT_JNULL;
+extern JMethod INIT_JSTR;
+extern JMethod INIT_JINT;
+extern JMethod INIT_JFLT;
+extern JMethod INIT_JBOOL;
+extern JMethod INIT_JUINT;
+extern JMethod INIT_JARR;
+extern JMethod INIT_JOBJ;
+
+// Cached methods
+extern JMethod MID_OBJ_TO_STR;
+extern JMethod MID_JNODE_KIND;
+extern JMethod MID_JNODE_SIZE;
+extern JMethod MID_JNODE_KEY_AT;
+extern JMethod MID_JNODE_VALUE_AT;
+extern JMethod MID_JSTR_STR;
+extern JMethod MID_JINT_NUM;
+extern JMethod MID_JFLT_NUM;
+extern JMethod MID_JBOOL_VALUE;
+extern JMethod MID_JUINT_GET;
+extern JMethod MID_JOBJ_ADD;
+extern JMethod MID_JARR_ADD;
+extern JMethod MID_BUF_POOL_ACQUIRE;
+extern JMethod MID_SINK_FLUSH;
+
+// Cached static methods
+extern JMethod MID_SYS_IDENTITY_HASH;
+
+// Cached fields
+extern JField FID_NODE_CTX;
+extern JField FID_NODE_HANDLE;
+extern JField FID_CTX_EXT_NATIVE;
+extern JField FID_CTX_NATIVE;
+extern JField FID_LAZY_CTX_NATIVE;
+extern JField FID_QUERY_NATIVE;
+extern JField FID_SINK_CHUNK;
+extern JField FID_ITER_NODE;
+extern JField FID_ITER_ORDER;
+extern JField FID_ITER_PTR;
+extern JField FID_ITER_CTX_EXT;
+extern JField FID_JITER_CTX;
+
+// Pins all the classes above and resolves all the method and field IDs.
+//
+// Must be called once from JNI_OnLoad. Returns false and leaves a pending
+// exception if any of them can not be found.
+bool cacheJNIRefs(JNIEnv *);
+
+// Releases the global class references pinned by cacheJNIRefs() and
+// invalidates all the cached IDs. Must be called from JNI_OnUnload.
+void releaseJNIRefs(JNIEnv *);
+
 // Checks through JNI, if there is a pending excption on the JVM side.
 //
 // Throws new RuntimeException to the JVM in case there is,
@@ -51,38 +172,109 @@ void checkJvmException(std::string);
 
 // Reads the JVM pointer of the current native thread.
 //
-// If the thread was not created by JVM - it will be attached to the JVM first.
-// Those threads need to be detached later on, in order to avoid memory leaks.
+// If the thread was not created by JVM - it will be attached to the JVM first
+// and automatically detached from it when the thread exits. The pointer of
+// such a thread is kept in thread-local storage.
 JNIEnv *getJNIEnv();
 
-// Constructs new Java object of a given className and constructor signature.
-jobject NewJavaObject(JNIEnv *, const char *, const char *, ...);
+// Creates the thread-local storage key used by getJNIEnv().
+// Must be called from JNI_OnLoad, before any call to getJNIEnv().
+bool createThreadEnvKey();
+
+// Deletes the thread-local storage key used by getJNIEnv().
+// Must be called from JNI_OnUnload, after the native threads that were
+// attached by getJNIEnv() are stopped: the ones still running are not
+// detached when they exit.
+void deleteThreadEnvKey();
 
-// Returns the field ID of the field of the given object.
-// The field is specified by its name and signature.
-jfieldID FieldID(JNIEnv *, jobject, const char *, const char *);
+// Default capacity of a LocalFrame. Enough for any single upcall.
+const jint LOCAL_FRAME_CAPACITY = 16;
+
+// Scoped JNI local reference frame.
+//
+// All local references created while the frame is alive are deleted on its
+// destruction, so it must wrap every per-node upcall and loop that creates
+// local references. A single reference can be kept alive in the enclosing
+// frame by passing it to pop().
+class LocalFrame {
+ public:
+  explicit LocalFrame(JNIEnv *env, jint capacity = LOCAL_FRAME_CAPACITY)
+      : env(env) {
+    pushed = env->PushLocalFrame(capacity) == JNI_OK;
+  }
+  ~LocalFrame() { pop(nullptr); }
+
+  // Pops the frame and returns a new local reference to the given object,
+  // which is valid in the enclosing frame.
+  jobject pop(jobject result) {
+    if (!pushed) return result;
+    pushed = false;
+    return env->PopLocalFrame(result);
+  }
+
+ private:
+  JNIEnv *env;
+  bool pushed;
+
+  LocalFrame(const LocalFrame &) = delete;
+  LocalFrame &operator=(const LocalFrame &) = delete;
+};
+
+// Builds an error message for a failed call of the given method.
+std::string describe(const char *, const JMethod &);
+
+// Builds an error message for a failed access to the given field.
+std::string describe(const char *, const JField &);
+
+// Constructs new Java object using the given cached constructor.
+template <typename... Args>
+jobject NewJavaObject(JNIEnv *env, const JMethod &init, Args... args) {
+  jobject instance = env->NewObject(init.cls->ref, init.id, args...);
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed to call constructor", init));
+  }
+  return instance;
+}
 
 // Reads the value of an Int field of a given object.
-// The field is specified by its name and signature.
-jint IntField(JNIEnv *, jobject, const char *, const char *);
+jint IntField(JNIEnv *, jobject, const JField &);
+
+// Reads the value of a Long field of a given object.
+jlong LongField(JNIEnv *, jobject, const JField &);
 
 // Reads the value of an Object field of a given object.
-// The field is specified by its name and signature.
-jobject ObjectField(JNIEnv *, jobject, const char *, const char *);
-
-// Returns the method ID for a method of a given class or interface name.
-// The method is determined by its name and signature.
-jmethodID MethodID(JNIEnv *, const char *, const char *, const char *);
-
-// Calls a method of the given class or interface name that returns an Int.
-// The method is determined by its name and signature.
-jint IntMethod(JNIEnv *, const char *, const char *, const char *,
-               const jobject);
-
-// Calls a method of the given class or interface name that returns an Object.
-// The method is determined by its name and signature.
-jobject ObjectMethod(JNIEnv *, const char *, const char *, const char *,
-                     const jobject, ...);
+jobject ObjectField(JNIEnv *, jobject, const JField &);
+
+// Sets the value of an Object field of a given object.
+void SetObjectField(JNIEnv *, jobject, const JField &, jobject);
+
+// Calls a cached method that returns an Int.
+jint IntMethod(JNIEnv *, const JMethod &, const jobject, ...);
+
+// Calls a cached static method that returns an Int.
+template <typename... Args>
+jint StaticIntMethod(JNIEnv *env, const JMethod &m, Args... args) {
+  jint res = env->CallStaticIntMethod(m.cls->ref, m.id, args...);
+  if (env->ExceptionCheck()) {
+    checkJvmException(describe("failed to call static method", m));
+  }
+  return res;
+}
+
+// Calls a cached method that returns a Long.
+jlong LongMethod(JNIEnv *, const JMethod &, const jobject, ...);
+
+// Calls a cached method that returns a Double.
+jdouble DoubleMethod(JNIEnv *, const JMethod &, const jobject, ...);
+
+// Calls a cached method that returns nothing.
+void VoidMethod(JNIEnv *, const JMethod &, const jobject, ...);
+
+// Calls a cached method that returns a Boolean.
+jboolean BooleanMethod(JNIEnv *, const JMethod &, const jobject, ...);
+
+// Calls a cached method that returns an Object.
+jobject ObjectMethod(JNIEnv *, const JMethod &, const jobject, ...);
 
 // Constructs new object the given class name and throws it to JVM.
 //
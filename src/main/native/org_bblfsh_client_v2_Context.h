@@ -18,25 +18,17 @@ JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_Context_root
 /*
  * Class:     org_bblfsh_client_v2_Context
  * Method:    filter
- * Signature: (Ljava/lang/String;Lorg/bblfsh/client/v2/JNode;)Lorg/bblfsh/client/v2/libuast/Libuast/UastIter;
+ * Signature: (Lorg/bblfsh/client/v2/PreparedQuery;Lorg/bblfsh/client/v2/JNode;)Lorg/bblfsh/client/v2/libuast/Libuast/UastIter;
  */
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_Context_filter
-  (JNIEnv *, jobject, jstring, jobject);
+  (JNIEnv *, jobject, jobject, jobject);
 
 /*
  * Class:     org_bblfsh_client_v2_Context
- * Method:    nativeEncode
- * Signature: (Lorg/bblfsh/client/v2/JNode;I)Ljava/nio/ByteBuffer;
- */
-JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_Context_nativeEncode
-  (JNIEnv *, jobject, jobject, jint);
-
-/*
- * Class:     org_bblfsh_client_v2_Context
- * Method:    dispose
+ * Method:    nativeDispose
  * Signature: ()V
  */
-JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_Context_dispose
+JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_Context_nativeDispose
   (JNIEnv *, jobject);
 
 #ifdef __cplusplus
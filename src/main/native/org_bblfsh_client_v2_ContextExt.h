@@ -18,27 +18,91 @@ JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_ContextExt_root
 /*
  * Class:     org_bblfsh_client_v2_ContextExt
  * Method:    filter
- * Signature: (Ljava/lang/String;)Lorg/bblfsh/client/v2/libuast/Libuast/UastIterExt;
+ * Signature: (Lorg/bblfsh/client/v2/PreparedQuery;)Lorg/bblfsh/client/v2/libuast/Libuast/UastIterExt;
  */
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_ContextExt_filter
-  (JNIEnv *, jobject, jstring);
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     org_bblfsh_client_v2_ContextExt
+ * Method:    filterHandles
+ * Signature: (Lorg/bblfsh/client/v2/PreparedQuery;)[J
+ */
+JNIEXPORT jlongArray JNICALL Java_org_bblfsh_client_v2_ContextExt_filterHandles
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     org_bblfsh_client_v2_ContextExt
+ * Method:    nativeFilterMany
+ * Signature: ([Lorg/bblfsh/client/v2/PreparedQuery;)[[J
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_bblfsh_client_v2_ContextExt_nativeFilterMany
+  (JNIEnv *, jobject, jobjectArray);
+
+/*
+ * Class:     org_bblfsh_client_v2_ContextExt
+ * Method:    nativeIterateHandles
+ * Signature: (I)[J
+ */
+JNIEXPORT jlongArray JNICALL Java_org_bblfsh_client_v2_ContextExt_nativeIterateHandles
+  (JNIEnv *, jobject, jint);
 
 /*
  * Class:     org_bblfsh_client_v2_ContextExt
  * Method:    nativeEncode
- * Signature: (Lorg/bblfsh/client/v2/NodeExt;I)Ljava/nio/ByteBuffer;
+ * Signature: (Lorg/bblfsh/client/v2/NodeExt;ILorg/bblfsh/client/v2/BufferPool;)Ljava/nio/ByteBuffer;
  */
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_ContextExt_nativeEncode
-  (JNIEnv *, jobject, jobject, jint);
+  (JNIEnv *, jobject, jobject, jint, jobject);
 
 /*
  * Class:     org_bblfsh_client_v2_ContextExt
- * Method:    dispose
+ * Method:    nativeDispose
  * Signature: ()V
  */
-JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_ContextExt_dispose
+JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_ContextExt_nativeDispose
   (JNIEnv *, jobject);
 
+/*
+ * Class:     org_bblfsh_client_v2_ContextExt
+ * Method:    count
+ * Signature: (Lorg/bblfsh/client/v2/PreparedQuery;)J
+ */
+JNIEXPORT jlong JNICALL Java_org_bblfsh_client_v2_ContextExt_count
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     org_bblfsh_client_v2_ContextExt
+ * Method:    exists
+ * Signature: (Lorg/bblfsh/client/v2/PreparedQuery;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_org_bblfsh_client_v2_ContextExt_exists
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     org_bblfsh_client_v2_ContextExt
+ * Method:    nativeCountBy
+ * Signature: (Ljava/lang/String;)[Ljava/lang/Object;
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_bblfsh_client_v2_ContextExt_nativeCountBy
+  (JNIEnv *, jobject, jstring);
+
+/*
+ * Class:     org_bblfsh_client_v2_ContextExt
+ * Method:    nativeToColumns
+ * Signature: (Lorg/bblfsh/client/v2/BufferPool;)[Ljava/lang/Object;
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_bblfsh_client_v2_ContextExt_nativeToColumns
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     org_bblfsh_client_v2_ContextExt
+ * Method:    nativeEncodeTo
+ * Signature: (Lorg/bblfsh/client/v2/NodeExt;ILorg/bblfsh/client/v2/ChunkSink;)V
+ */
+JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_ContextExt_nativeEncodeTo
+  (JNIEnv *, jobject, jobject, jint, jobject);
+
 #ifdef __cplusplus
 }
 #endif
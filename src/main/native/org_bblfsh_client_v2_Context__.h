@@ -15,6 +15,30 @@ extern "C" {
 JNIEXPORT jlong JNICALL Java_org_bblfsh_client_v2_Context_00024_create
   (JNIEnv *, jobject);
 
+/*
+ * Class:     org_bblfsh_client_v2_Context__
+ * Method:    encodeFlat
+ * Signature: (Ljava/nio/ByteBuffer;IILorg/bblfsh/client/v2/BufferPool;)Ljava/nio/ByteBuffer;
+ */
+JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_Context_00024_encodeFlat
+  (JNIEnv *, jobject, jobject, jint, jint, jobject);
+
+/*
+ * Class:     org_bblfsh_client_v2_Context__
+ * Method:    encodeFlatToArray
+ * Signature: (Ljava/nio/ByteBuffer;II)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_org_bblfsh_client_v2_Context_00024_encodeFlatToArray
+  (JNIEnv *, jobject, jobject, jint, jint);
+
+/*
+ * Class:     org_bblfsh_client_v2_Context__
+ * Method:    encodeFlatTo
+ * Signature: (Ljava/nio/ByteBuffer;IILorg/bblfsh/client/v2/ChunkSink;)V
+ */
+JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_Context_00024_encodeFlatTo
+  (JNIEnv *, jobject, jobject, jint, jint, jobject);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,29 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class org_bblfsh_client_v2_LazyContext */
+
+#ifndef _Included_org_bblfsh_client_v2_LazyContext
+#define _Included_org_bblfsh_client_v2_LazyContext
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     org_bblfsh_client_v2_LazyContext
+ * Method:    expand
+ * Signature: (J)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_org_bblfsh_client_v2_LazyContext_expand
+  (JNIEnv *, jobject, jlong);
+
+/*
+ * Class:     org_bblfsh_client_v2_LazyContext
+ * Method:    nativeDispose
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_LazyContext_nativeDispose
+  (JNIEnv *, jobject);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
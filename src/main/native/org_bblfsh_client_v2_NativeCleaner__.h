@@ -0,0 +1,21 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class org_bblfsh_client_v2_NativeCleaner__ */
+
+#ifndef _Included_org_bblfsh_client_v2_NativeCleaner__
+#define _Included_org_bblfsh_client_v2_NativeCleaner__
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     org_bblfsh_client_v2_NativeCleaner__
+ * Method:    free
+ * Signature: (IJ)V
+ */
+JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_NativeCleaner_00024_free
+  (JNIEnv *, jobject, jint, jlong);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
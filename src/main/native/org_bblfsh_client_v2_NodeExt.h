@@ -9,18 +9,50 @@ extern "C" {
 #endif
 /*
  * Class:     org_bblfsh_client_v2_NodeExt
- * Method:    load
- * Signature: ()Lorg/bblfsh/client/v2/JNode;
+ * Method:    nativeLoad
+ * Signature: ()[B
  */
-JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_NodeExt_load
+JNIEXPORT jbyteArray JNICALL Java_org_bblfsh_client_v2_NodeExt_nativeLoad
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     org_bblfsh_client_v2_NodeExt
+ * Method:    nativeView
+ * Signature: ()Lorg/bblfsh/client/v2/LazyContext;
+ */
+JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_NodeExt_nativeView
   (JNIEnv *, jobject);
 
 /*
  * Class:     org_bblfsh_client_v2_NodeExt
  * Method:    filter
- * Signature: (Ljava/lang/String;)Lorg/bblfsh/client/v2/libuast/Libuast/UastIterExt;
+ * Signature: (Lorg/bblfsh/client/v2/PreparedQuery;)Lorg/bblfsh/client/v2/libuast/Libuast/UastIterExt;
  */
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_NodeExt_filter
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     org_bblfsh_client_v2_NodeExt
+ * Method:    count
+ * Signature: (Lorg/bblfsh/client/v2/PreparedQuery;)J
+ */
+JNIEXPORT jlong JNICALL Java_org_bblfsh_client_v2_NodeExt_count
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     org_bblfsh_client_v2_NodeExt
+ * Method:    exists
+ * Signature: (Lorg/bblfsh/client/v2/PreparedQuery;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_org_bblfsh_client_v2_NodeExt_exists
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     org_bblfsh_client_v2_NodeExt
+ * Method:    nativeCountBy
+ * Signature: (Ljava/lang/String;)[Ljava/lang/Object;
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_bblfsh_client_v2_NodeExt_nativeCountBy
   (JNIEnv *, jobject, jstring);
 
 #ifdef __cplusplus
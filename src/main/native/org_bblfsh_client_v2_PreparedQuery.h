@@ -0,0 +1,21 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class org_bblfsh_client_v2_PreparedQuery */
+
+#ifndef _Included_org_bblfsh_client_v2_PreparedQuery
+#define _Included_org_bblfsh_client_v2_PreparedQuery
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     org_bblfsh_client_v2_PreparedQuery
+ * Method:    nativeDispose
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_PreparedQuery_nativeDispose
+  (JNIEnv *, jobject);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,21 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class org_bblfsh_client_v2_PreparedQuery__ */
+
+#ifndef _Included_org_bblfsh_client_v2_PreparedQuery__
+#define _Included_org_bblfsh_client_v2_PreparedQuery__
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     org_bblfsh_client_v2_PreparedQuery__
+ * Method:    prepare
+ * Signature: (Ljava/lang/String;)J
+ */
+JNIEXPORT jlong JNICALL Java_org_bblfsh_client_v2_PreparedQuery_00024_prepare
+  (JNIEnv *, jobject, jstring);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,11 +1,29 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "flat_uast.h"
 #include "jni_utils.h"
 #include "org_bblfsh_client_v2_Context.h"
 #include "org_bblfsh_client_v2_ContextExt.h"
 #include "org_bblfsh_client_v2_Context__.h"
+#include "org_bblfsh_client_v2_LazyContext.h"
+#include "org_bblfsh_client_v2_NativeCleaner__.h"
 #include "org_bblfsh_client_v2_NodeExt.h"
+#include "org_bblfsh_client_v2_PreparedQuery.h"
+#include "org_bblfsh_client_v2_PreparedQuery__.h"
 #include "org_bblfsh_client_v2_libuast_Libuast.h"
 #include "org_bblfsh_client_v2_libuast_Libuast_UastIter.h"
 #include "org_bblfsh_client_v2_libuast_Libuast_UastIterExt.h"
@@ -18,75 +36,208 @@
 JavaVM *jvm;
 
 namespace {
-constexpr char nativeContext[] = "nativeContext";
-
-// Reads the opaque native pointer out of the field of the given object.
+// Reads the opaque native pointer out of the given field of the object.
 //
-// The field is specified by its name and signature.
 // Opaque pointer is casted to the given native type T.
 template <typename T>
-T *getHandle(JNIEnv *env, jobject obj, const char *name, const char *sig) {
-  jfieldID fId = FieldID(env, obj, name, sig);
-  if (!fId) return nullptr;
-
-  jlong handle = env->GetLongField(obj, fId);
-  checkJvmException("failed to get long field " + std::string(name));
+T *getHandle(JNIEnv *env, jobject obj, const JField &field) {
+  jlong handle = LongField(env, obj, field);
   return reinterpret_cast<T *>(handle);
 }
 
-// Reads the opaque native pointer out of the given object's field.
-//
-// The field is specified by its name.
-// Opaque pointer is casted to the given native type T.
 template <typename T>
-T *getHandle(JNIEnv *env, jobject obj, const char *name) {
-  return getHandle<T>(env, obj, name, "J");
+void setHandle(JNIEnv *env, jobject obj, T *t, const JField &field) {
+  jlong handle = reinterpret_cast<jlong>(t);
+  env->SetLongField(obj, field.id, handle);
+  checkJvmException("failed to set handle for " + std::string(field.name));
 }
 
+// Retained holds a reference to the native object of a JVM context for the
+// duration of a native call, so a close() on another thread can not free it
+// under the call.
+//
+// The reference is taken while holding the monitor of the JVM object, that
+// close() is synchronized on. Throws to the JVM if the context is null or
+// already closed.
 template <typename T>
-void setHandle(JNIEnv *env, jobject obj, T *t, const char *name,
-               const char *sig) {
-  jfieldID fId = FieldID(env, obj, name, sig);
-  if (!fId) return;
+class Retained {
+ private:
+  T *ptr;
 
-  jlong handle = reinterpret_cast<jlong>(t);
-  env->SetLongField(obj, fId, handle);
-  checkJvmException("failed to set handle for" + std::string(name));
+ public:
+  Retained(JNIEnv *env, jobject obj, const JField &field) : ptr(nullptr) {
+    if (obj && env->MonitorEnter(obj) == JNI_OK) {
+      ptr = getHandle<T>(env, obj, field);
+      if (ptr) ptr->Retain();
+      env->MonitorExit(obj);
+    }
+    if (!ptr && !env->ExceptionCheck()) {
+      ThrowByName(env, CLS_RE, "UAST context is already closed");
+    }
+  }
+  ~Retained() {
+    if (ptr) ptr->Release();
+  }
+
+  Retained(const Retained &) = delete;
+  Retained &operator=(const Retained &) = delete;
+
+  T *get() const { return ptr; }
+  T *operator->() const { return ptr; }
+  explicit operator bool() const { return ptr != nullptr; }
+};
+
+// Copies the given data to a buffer acquired from the given JVM BufferPool.
+jobject asPooledBuffer(const void *data, size_t size, jobject pool) {
+  JNIEnv *env = getJNIEnv();
+  if (size > size_t(INT32_MAX)) {
+    ThrowByName(env, CLS_RE, "UAST is too large for a buffer");
+    return nullptr;
+  }
+
+  jobject jBuf = ObjectMethod(env, MID_BUF_POOL_ACQUIRE, pool, jint(size));
+  if (env->ExceptionCheck() || !jBuf) return nullptr;
+  if (size == 0) return jBuf;  // may have no address
+
+  void *dst = env->GetDirectBufferAddress(jBuf);
+  if (!dst || env->GetDirectBufferCapacity(jBuf) < jlong(size)) {
+    ThrowByName(env, CLS_RE, "BufferPool returned an unusable buffer");
+    return nullptr;
+  }
+  memcpy(dst, data, size);
+  return jBuf;
 }
 
-template <typename T>
-void setHandle(JNIEnv *env, jobject obj, T *t, const char *name) {
-  setHandle<T>(env, obj, t, name, "J");
+// Copies encoded UAST to a buffer acquired from the given JVM BufferPool,
+// and frees the memory allocated by libuast for it.
+jobject asPooledBuffer(uast::Buffer buf, jobject pool) {
+  // owned by libuast, allocated with malloc
+  std::unique_ptr<void, decltype(&free)> data(buf.ptr, &free);
+
+  return asPooledBuffer(buf.ptr, buf.size, pool);
+}
+
+// Streams encoded UAST to a given JVM ChunkSink, by copying it to the
+// sink's chunk buffer one chunk at a time, and frees the memory allocated
+// by libuast for it. Stops at the first failed chunk, leaving the exception
+// pending.
+void streamTo(uast::Buffer buf, jobject sink) {
+  // owned by libuast, allocated with malloc
+  std::unique_ptr<void, decltype(&free)> data(buf.ptr, &free);
+
+  JNIEnv *env = getJNIEnv();
+  LocalFrame frame(env);
+  jobject chunk = ObjectField(env, sink, FID_SINK_CHUNK);
+  if (env->ExceptionCheck() || !chunk) return;
+
+  char *dst = static_cast<char *>(env->GetDirectBufferAddress(chunk));
+  jlong capacity = env->GetDirectBufferCapacity(chunk);
+  if (!dst || capacity <= 0) {
+    ThrowByName(env, CLS_RE, "ChunkSink has an unusable chunk buffer");
+    return;
+  }
+
+  const char *src = static_cast<const char *>(buf.ptr);
+  for (size_t off = 0; off < buf.size;) {
+    size_t n = std::min(buf.size - off, size_t(capacity));
+    memcpy(dst, src + off, n);
+    VoidMethod(env, MID_SINK_FLUSH, sink, jint(n));
+    if (env->ExceptionCheck()) return;
+    off += n;
+  }
+}
+
+// Copies encoded UAST to a new JVM byte array, and frees the memory
+// allocated by libuast for it.
+jbyteArray asJvmArray(uast::Buffer buf) {
+  // owned by libuast, allocated with malloc
+  std::unique_ptr<void, decltype(&free)> data(buf.ptr, &free);
+
+  JNIEnv *env = getJNIEnv();
+  if (buf.size > size_t(INT32_MAX)) {
+    ThrowByName(env, CLS_RE, "encoded UAST is too large for an array");
+    return nullptr;
+  }
+
+  jbyteArray arr = env->NewByteArray(jsize(buf.size));
+  if (!arr) return nullptr;  // OutOfMemoryError is pending
+
+  env->SetByteArrayRegion(arr, 0, jsize(buf.size),
+                          reinterpret_cast<const jbyte *>(buf.ptr));
+  return arr;
 }
 
-void setObjectField(JNIEnv *env, jobject obj, jobject field, const char *name, const char *sig) {
-  jfieldID fId = FieldID(env, obj, name, sig);
-  env->SetObjectField(obj, fId, field);
-  checkJvmException("failed to set object field for" + std::string(name));
+// Copies the given data to a new JVM byte array.
+jbyteArray asJvmArray(const std::vector<char> &data) {
+  JNIEnv *env = getJNIEnv();
+  jbyteArray arr = env->NewByteArray(jsize(data.size()));
+  if (!arr) return nullptr;  // OutOfMemoryError is pending
+
+  env->SetByteArrayRegion(arr, 0, jsize(data.size()),
+                          reinterpret_cast<const jbyte *>(data.data()));
+  return arr;
 }
 
-jobject asJvmBuffer(uast::Buffer buf) {
+// Drains the given iterator to a new JVM long array of node handles.
+// Takes ownership of the iterator.
+jlongArray asJvmHandles(uast::Iterator<NodeHandle> *iter) {
+  std::unique_ptr<uast::Iterator<NodeHandle>> it(iter);
+
+  std::vector<jlong> handles;
+  while (it->next()) {
+    handles.push_back(jlong(it->node()));
+  }
+
   JNIEnv *env = getJNIEnv();
-  return env->NewDirectByteBuffer(buf.ptr, buf.size);
+  jlongArray arr = env->NewLongArray(jsize(handles.size()));
+  if (!arr) return nullptr;  // OutOfMemoryError is pending
+
+  env->SetLongArrayRegion(arr, 0, jsize(handles.size()), handles.data());
+  return arr;
+}
+
+// Native state of PreparedQuery: the query text converted to UTF-8 once.
+//
+// libuast 3.4.2 has no API for compiled queries, its Filter takes the query
+// text and compiles it on every call. So this only saves converting a JVM
+// String on every call, not the compilation.
+class PreparedQuery {
+ public:
+  const std::string text;
+
+  explicit PreparedQuery(std::string t) : text(std::move(t)) {}
+};
+
+// Copies the text of a given PreparedQuery.
+//
+// The copy is taken while holding the monitor of the JVM object, that
+// close() is synchronized on, so a concurrent close() can not free the
+// query under the call. Returns false and throws to the JVM if the query
+// is null or disposed.
+bool toQuery(JNIEnv *env, jobject jquery, std::string *text) {
+  const PreparedQuery *q = nullptr;
+  if (jquery && env->MonitorEnter(jquery) == JNI_OK) {
+    q = getHandle<PreparedQuery>(env, jquery, FID_QUERY_NATIVE);
+    if (q) *text = q->text;
+    env->MonitorExit(jquery);
+  }
+  if (!q && !env->ExceptionCheck()) {
+    ThrowByName(env, CLS_RE, "query is null or already disposed");
+  }
+  return q != nullptr;
 }
 
 // Checks if a given object is of ContextExt class
 bool isContext(jobject obj, JNIEnv *env) {
   if (!obj) return false;
 
-  jclass ctxCls = env->FindClass(CLS_CTX_EXT);
-  checkJvmException("failed to find class " + std::string(CLS_CTX_EXT));
-
-  return env->IsInstanceOf(obj, ctxCls);
+  return env->IsInstanceOf(obj, CLASS_CTX_EXT.ref);
 }
 
 bool assertNotContext(jobject obj) {
   JNIEnv *env = getJNIEnv();
   if (isContext(obj, env)) {
-    auto reCls = env->FindClass(CLS_RE);
-    checkJvmException("failed to find class " + std::string(CLS_RE));
-
-    env->ThrowNew(reCls, "cannot use UAST Context as a Node");
+    env->ThrowNew(CLASS_RE.ref, "cannot use UAST Context as a Node");
     return false;
   }
   return true;
@@ -100,12 +251,16 @@ class ContextExt {
  private:
   uast::Context<NodeHandle> *ctx;
   jobject jCtxExt;
+  // guards ctx and all iterators over it
+  std::mutex mu;
+  // number of owners: the JVM object and every iterator over the context
+  std::atomic<int> refs;
 
   jobject toJ(NodeHandle node) {
     if (node == 0) return nullptr;
 
     JNIEnv *env = getJNIEnv();
-    jobject jObj = NewJavaObject(env, CLS_NODE, METHOD_NODE_INIT, jCtxExt, node);
+    jobject jObj = NewJavaObject(env, INIT_NODE, jCtxExt, node);
     return jObj;
   }
 
@@ -114,11 +269,8 @@ class ContextExt {
   NodeHandle toHandle(jobject obj) {
     if (!obj) return 0;
 
-    JNIEnv *env = getJNIEnv();  // TODO: refactor to JNI util LongField()
-    jclass cls = env->FindClass(CLS_NODE);
-    checkJvmException("failed to find class " + std::string(CLS_NODE));
-
-    if (!env->IsInstanceOf(obj, cls)) {
+    JNIEnv *env = getJNIEnv();
+    if (!env->IsInstanceOf(obj, CLASS_NODE.ref)) {
       auto err = std::string("ContextExt.toHandle() argument is not")
                      .append(CLS_NODE)
                      .append(" type");
@@ -126,21 +278,11 @@ class ContextExt {
       return 0;
     }
 
-    jfieldID fId = FieldID(env, obj, "handle", "J");
-    if (!fId) {
-      return 0;
-    }
-
-    auto handle = (NodeHandle)env->GetLongField(obj, fId);
-    checkJvmException("failed to get field NodeExt.handle");
-
-    return handle;
+    return (NodeHandle)LongField(env, obj, FID_NODE_HANDLE);
   }
 
  public:
-  friend class Context;
-
-  ContextExt(uast::Context<NodeHandle> *c) : ctx(c) {}
+  ContextExt(uast::Context<NodeHandle> *c) : ctx(c), jCtxExt(nullptr), refs(1) {}
 
   ~ContextExt() {
     delete (ctx);
@@ -153,10 +295,26 @@ class ContextExt {
   jobject lookup(NodeHandle node) { return toJ(node); }
 
   jobject RootNode() {
-    NodeHandle root = ctx->RootNode();
+    NodeHandle root;
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      root = ctx->RootNode();
+    }
     return lookup(root);
   }
 
+  // Mutex returns the lock that must be held while using iterators over
+  // this context.
+  std::mutex &Mutex() { return mu; }
+
+  // Retain adds an owner of the context, and Release removes one. The
+  // context is deleted by the last owner, so iterators can outlive the
+  // disposal of its JVM object.
+  void Retain() { refs++; }
+  void Release() {
+    if (--refs == 0) delete this;
+  }
+
   // Attaches a Scala ContextExt object to the C ContextExt
   // We need this because a NodeExt from Scala side includes
   // a Scala ContextExt and a handle to the native C node
@@ -169,6 +327,7 @@ class ContextExt {
   uast::Iterator<NodeHandle> *Iterate(jobject node, TreeOrder order) {
     if (!assertNotContext(node)) return nullptr;
 
+    std::lock_guard<std::mutex> lock(mu);
     NodeHandle h = toHandle(node);
     auto iter = ctx->Iterate(h, order);
     return iter;
@@ -179,6 +338,7 @@ class ContextExt {
   uast::Iterator<NodeHandle> *Filter(jobject node, std::string query) {
     if (!assertNotContext(node)) return nullptr;
 
+    std::lock_guard<std::mutex> lock(mu);
     NodeHandle unode = toHandle(node);
     if (unode == 0) unode = ctx->RootNode();
 
@@ -186,21 +346,348 @@ class ContextExt {
     return it;
   }
 
-  // Encode serializes the external UAST.
-  // Borrows the reference.
-  jobject Encode(jobject node, UastFormat format) {
+  // FilterHandles queries the whole external UAST and returns handles of all
+  // matching nodes, without creating any JVM objects for them.
+  jlongArray FilterHandles(const std::string &query) {
+    std::lock_guard<std::mutex> lock(mu);
+    return asJvmHandles(ctx->Filter(ctx->RootNode(), query));
+  }
+
+  // FilterMany runs all the given queries on the whole external UAST and
+  // returns a JVM array with an array of handles of the matching nodes for
+  // each query. Each query is still a separate pass over the tree, this only
+  // saves the JNI calls and the locking per query.
+  //
+  // The handles are collected under the lock, and the JVM arrays are built
+  // after releasing it, so other threads do not wait on JVM allocations.
+  jobjectArray FilterMany(const std::vector<std::string> &queries) {
+    std::vector<std::vector<jlong>> found(queries.size());
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      NodeHandle root = ctx->RootNode();
+      for (size_t i = 0; i < queries.size(); i++) {
+        std::unique_ptr<uast::Iterator<NodeHandle>> it(
+            ctx->Filter(root, queries[i]));
+        while (it->next()) {
+          found[i].push_back(jlong(it->node()));
+        }
+      }
+    }
+
+    JNIEnv *env = getJNIEnv();
+    jobjectArray res =
+        env->NewObjectArray(jsize(found.size()), CLASS_LONG_ARR.ref, nullptr);
+    if (!res) return nullptr;  // OutOfMemoryError is pending
+
+    for (size_t i = 0; i < found.size(); i++) {
+      jlongArray handles = env->NewLongArray(jsize(found[i].size()));
+      if (!handles) return nullptr;  // OutOfMemoryError is pending
+
+      env->SetLongArrayRegion(handles, 0, jsize(found[i].size()),
+                              found[i].data());
+      env->SetObjectArrayElement(res, jsize(i), handles);
+      env->DeleteLocalRef(handles);
+    }
+    return res;
+  }
+
+  // Count returns the number of nodes under a given node, or under the root
+  // if it is zero, that match the query. No JVM objects are created for them.
+  jlong Count(NodeHandle node, const std::string &query) {
+    std::lock_guard<std::mutex> lock(mu);
+    if (node == 0) node = ctx->RootNode();
+
+    std::unique_ptr<uast::Iterator<NodeHandle>> it(ctx->Filter(node, query));
+    jlong n = 0;
+    while (it->next()) n++;
+    return n;
+  }
+
+  // Exists checks if any node under a given node, or under the root if it is
+  // zero, matches the query. Stops at the first match.
+  bool Exists(NodeHandle node, const std::string &query) {
+    std::lock_guard<std::mutex> lock(mu);
+    if (node == 0) node = ctx->RootNode();
+
+    std::unique_ptr<uast::Iterator<NodeHandle>> it(ctx->Filter(node, query));
+    return it->next();
+  }
+
+  // CountBy counts the values of a given field in all the objects under a
+  // given node, or under the root if it is zero. Returns a JVM array of two
+  // elements: an array of the values and an array of their counts.
+  jobjectArray CountBy(NodeHandle node, const std::string &field) {
+    FlatContext dst;
+    FlatNode *root;
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      if (node == 0) node = ctx->RootNode();
+      root = uast::Load(ctx, node, dst.Ctx());
+    }
+
+    std::unordered_map<std::string, int64_t> counts;
+    ::CountBy(root, field, &counts);
+
+    JNIEnv *env = getJNIEnv();
+    jsize n = jsize(counts.size());
+    jobjectArray res = env->NewObjectArray(2, CLASS_OBJ.ref, nullptr);
+    jobjectArray keys = env->NewObjectArray(n, CLASS_STR.ref, nullptr);
+    jlongArray values = env->NewLongArray(n);
+    if (!res || !keys || !values) return nullptr;  // OutOfMemoryError is pending
+
+    std::vector<jlong> nums;
+    nums.reserve(n);
+    jsize i = 0;
+    for (const auto &kv : counts) {
+      jstring key = env->NewStringUTF(kv.first.c_str());
+      if (!key) return nullptr;
+      env->SetObjectArrayElement(keys, i++, key);
+      env->DeleteLocalRef(key);
+      nums.push_back(jlong(kv.second));
+    }
+    env->SetLongArrayRegion(values, 0, n, nums.data());
+
+    env->SetObjectArrayElement(res, 0, keys);
+    env->SetObjectArrayElement(res, 1, values);
+    return res;
+  }
+
+  // ToColumns copies the external UAST to the JVM in the columnar layout of
+  // flat_uast.h. Returns a JVM array with a buffer from the given pool for
+  // each column, in ColumnId order.
+  jobjectArray ToColumns(jobject pool) {
+    FlatContext dst;
+    FlatNode *root;
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      root = uast::Load(ctx, ctx->RootNode(), dst.Ctx());
+    }
+
+    Columns cols;
+    ::ToColumns(root, &cols);
+
+    JNIEnv *env = getJNIEnv();
+    jobjectArray res = env->NewObjectArray(NUM_COLUMNS, CLASS_OBJ.ref, nullptr);
+    if (!res) return nullptr;  // OutOfMemoryError is pending
+
+    for (int i = 0; i < NUM_COLUMNS; i++) {
+      ColumnId col = ColumnId(i);
+      jobject buf = asPooledBuffer(cols.Data(col), cols.Bytes(col), pool);
+      if (!buf) return nullptr;
+      env->SetObjectArrayElement(res, i, buf);
+      env->DeleteLocalRef(buf);
+    }
+    return res;
+  }
+
+  // IterateHandles returns handles of all nodes of the external UAST in a
+  // given order, without creating any JVM objects for them.
+  jlongArray IterateHandles(TreeOrder order) {
+    std::lock_guard<std::mutex> lock(mu);
+    return asJvmHandles(ctx->Iterate(ctx->RootNode(), order));
+  }
+
+  // Encode serializes the external UAST to a buffer from the given pool.
+  // Borrows the references.
+  jobject Encode(jobject node, UastFormat format, jobject pool) {
     if (!assertNotContext(node)) return nullptr;
 
+    std::unique_lock<std::mutex> lock(mu);
+    uast::Buffer data = ctx->Encode(toHandle(node), format);
+    lock.unlock();
+    return asPooledBuffer(data, pool);
+  }
+
+  // EncodeTo serializes the external UAST and streams it to a given sink in
+  // chunks. Borrows the references.
+  void EncodeTo(jobject node, UastFormat format, jobject sink) {
+    if (!assertNotContext(node)) return;
+
+    std::unique_lock<std::mutex> lock(mu);
     uast::Buffer data = ctx->Encode(toHandle(node), format);
-    return asJvmBuffer(data);
+    lock.unlock();
+    streamTo(data, sink);
+  }
+
+  // LoadFlat copies the external UAST under a given node to the JVM, in
+  // the flat layout of flat_uast.h. Libuast builds the copy out of native
+  // FlatNodes, so there are no JNI calls per node.
+  // Borrows the reference.
+  jbyteArray LoadFlat(jobject node) {
+    FlatContext dst;
+    FlatNode *root;
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      root = uast::Load(ctx, toHandle(node), dst.Ctx());
+    }
+    if (!root) return nullptr;
+
+    return asJvmArray(dst.Tree()->Serialize(root));
+  }
+
+  // LoadTo copies the external UAST under a given node to a native flat
+  // context, and returns the root of the copy.
+  FlatNode *LoadTo(NodeHandle node, FlatContext *dst) {
+    std::lock_guard<std::mutex> lock(mu);
+    return uast::Load(ctx, node, dst->Ctx());
+  }
+
+  // View returns a new native LazyContext for the external UAST under a
+  // given node, that materializes it on the JVM side on demand.
+  // Borrows the reference.
+  jobject View(jobject node);
+};
+
+// ==========================================
+// Lazy UAST Context (native copy of an external UAST)
+// ==========================================
+
+// LazyContext serves the nodes of an external UAST to JLazy, one level at
+// a time.
+//
+// libuast 3.4.2 can only read an external UAST by loading a whole subtree,
+// it has no accessors for a single node. So the subtree is copied on the
+// first expansion, not when the view is created, and is served from the
+// copy afterwards. Until then the LazyContext keeps the ContextExt alive.
+//
+// Not thread-safe, the JVM object is locked during each call.
+class LazyContext {
+ private:
+  // source of the copy, released once the copy is made
+  ContextExt *src;
+  NodeHandle node;
+
+  FlatContext flat;
+  FlatNode *root;
+  // objects and arrays of the copy, the only nodes that JLazy can refer to
+  std::unordered_set<FlatNode *> owned;
+
+  void index() {
+    std::vector<FlatNode *> stack;
+    if (root) stack.push_back(root);
+    while (!stack.empty()) {
+      FlatNode *n = stack.back();
+      stack.pop_back();
+      NodeKind kind = n->Kind();
+      if (kind != NODE_OBJECT && kind != NODE_ARRAY) continue;
+      if (!owned.insert(n).second) continue;
+      for (size_t i = 0, sz = n->Size(); i < sz; i++) {
+        FlatNode *v = n->ValueAt(i);
+        if (v) stack.push_back(v);
+      }
+    }
+  }
+
+ public:
+  LazyContext(ContextExt *c, NodeHandle n) : src(c), node(n), root(nullptr) {
+    src->Retain();
+  }
+  ~LazyContext() {
+    if (src) src->Release();
+  }
+
+  // Expand returns a given node in the flat layout, with its children
+  // objects and arrays written as references. Zero stands for the root.
+  //
+  // Throws std::runtime_error if the handle is not a node of this copy.
+  jbyteArray Expand(jlong handle) {
+    if (src) {
+      root = src->LoadTo(node, &flat);
+      src->Release();
+      src = nullptr;
+      index();
+    }
+
+    FlatNode *n = root;
+    if (handle) {
+      // checked before it is dereferenced, handles come from the JVM
+      n = reinterpret_cast<FlatNode *>(handle);
+      if (!owned.count(n)) {
+        throw std::runtime_error("node does not belong to the LazyContext");
+      }
+    }
+    if (!n) return nullptr;
+
+    return asJvmArray(flat.Tree()->Serialize(n, 0));
+  }
+};
+
+jobject ContextExt::View(jobject node) {
+  NodeHandle h;
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    h = toHandle(node);
+  }
+  LazyContext *lazy = new LazyContext(this, h);
+
+  JNIEnv *env = getJNIEnv();
+  jobject jLazy = NewJavaObject(env, INIT_LAZY_CTX, lazy);
+  if (env->ExceptionCheck() || !jLazy) {
+    delete (lazy);
+    return nullptr;
+  }
+  return jLazy;
+}
+
+// Native state of UastIterExt.
+//
+// Caches the ContextExt that owns the iterated nodes, so it is not looked up
+// through JNI for every node, and holds its lock while using the iterator.
+class IterExt {
+ public:
+  uast::Iterator<NodeHandle> *iter;
+  ContextExt *ctx;
+
+  IterExt(uast::Iterator<NodeHandle> *it, ContextExt *c) : iter(it), ctx(c) {
+    ctx->Retain();
+  }
+  ~IterExt() {
+    {
+      std::lock_guard<std::mutex> lock(ctx->Mutex());
+      delete (iter);
+    }
+    ctx->Release();
+  }
+
+  // next advances the iterator and returns a JVM object of the next node,
+  // or null at the end of the iteration.
+  jobject next() {
+    if (!iter) return nullptr;
+
+    NodeHandle node;
+    {
+      std::lock_guard<std::mutex> lock(ctx->Mutex());
+      if (!iter->next()) return nullptr;
+      node = iter->node();
+    }
+    if (node == 0) return nullptr;
+    return ctx->lookup(node);
   }
 };
 
+// nextBatch fills a given array with up to its length next objects returned
+// by the iterator, and returns their number. Zero means the end of iteration.
+template <typename F>
+jint nextBatch(JNIEnv *env, jobjectArray out, F next) {
+  jsize len = env->GetArrayLength(out);
+
+  jint n = 0;
+  while (n < len) {
+    jobject obj = next();
+    if (!obj) break;
+
+    env->SetObjectArrayElement(out, n, obj);
+    env->DeleteLocalRef(obj);
+    if (env->ExceptionCheck()) return n;
+    n++;
+  }
+  return n;
+}
+
 // creates new UastIterExt from the given context
-jobject filterUastIterExt(ContextExt *ctx, jobject jCtx, jstring jquery, JNIEnv *env) {
-  const char *q = env->GetStringUTFChars(jquery, 0);
-  std::string query = std::string(q);
-  env->ReleaseStringUTFChars(jquery, q);
+jobject filterUastIterExt(ContextExt *ctx, jobject jCtx, jobject jquery, JNIEnv *env) {
+  std::string query;
+  if (!toQuery(env, jquery, &query)) return nullptr;
 
   auto node = ctx->RootNode();
   uast::Iterator<NodeHandle> *it = nullptr;
@@ -211,11 +698,13 @@ jobject filterUastIterExt(ContextExt *ctx, jobject jCtx, jstring jquery, JNIEnv
     return nullptr;
   }
 
+  IterExt *state = new IterExt(it, ctx);
+
   // new UastIterExt()
-  jobject iter = NewJavaObject(env, CLS_ITER, METHOD_ITER_INIT, 0, 0, it, jCtx);
+  jobject iter = NewJavaObject(env, INIT_ITER, 0, 0, state, jCtx);
 
   if (env->ExceptionCheck() || !iter) {
-    delete (it);
+    delete (state);
     checkJvmException("failed create new UastIterExt class");
   }
   return iter;
@@ -229,30 +718,31 @@ class Interface;
 class Node : public uast::Node<Node *> {
  private:
   Interface *iface;
-  jobject obj;  // Node owns a (global) reference
+  jobject obj;  // Node owns a (global) reference, released by Interface
   NodeKind kind;
 
-  std::string *str;
+  const std::string *str;  // owned by the Interface arena
 
   // kindOf returns a kind of a JVM object.
   // Borrows the reference.
   static NodeKind kindOf(jobject obj) {
-    JNIEnv *env = getJNIEnv();
-    // TODO(bzz): expose JNode.kind & replace type comparison \w a string test
-    if (!obj || env->IsInstanceOf(obj, env->FindClass(CLS_JNULL))) {
-      return NODE_NULL;
-    } else if (env->IsInstanceOf(obj, env->FindClass(CLS_JSTR))) {
-      return NODE_STRING;
-    } else if (env->IsInstanceOf(obj, env->FindClass(CLS_JINT))) {
-      return NODE_INT;
-    } else if (env->IsInstanceOf(obj, env->FindClass(CLS_JFLT))) {
-      return NODE_FLOAT;
-    } else if (env->IsInstanceOf(obj, env->FindClass(CLS_JBOOL))) {
-      return NODE_BOOL;
-    } else if (env->IsInstanceOf(obj, env->FindClass(CLS_JUINT))) {
-      return NODE_UINT;
-    } else if (env->IsInstanceOf(obj, env->FindClass(CLS_JARR))) {
-      return NODE_ARRAY;
+    if (!obj) return NODE_NULL;
+
+    switch (IntMethod(getJNIEnv(), MID_JNODE_KIND, obj)) {
+      case JNODE_KIND_NULL:
+        return NODE_NULL;
+      case JNODE_KIND_ARRAY:
+        return NODE_ARRAY;
+      case JNODE_KIND_STRING:
+        return NODE_STRING;
+      case JNODE_KIND_INT:
+        return NODE_INT;
+      case JNODE_KIND_UINT:
+        return NODE_UINT;
+      case JNODE_KIND_FLOAT:
+        return NODE_FLOAT;
+      case JNODE_KIND_BOOL:
+        return NODE_BOOL;
     }
     return NODE_OBJECT;
   }
@@ -261,6 +751,7 @@ class Node : public uast::Node<Node *> {
 
  public:
   friend class Interface;
+  friend class NodeRegistry;
   friend class Context;
 
   // Node creates a new node associated with a given JVM object and sets the
@@ -279,89 +770,30 @@ class Node : public uast::Node<Node *> {
     kind = kindOf(v);
   }
 
-  ~Node() {
-    JNIEnv *env = getJNIEnv();
-    if (obj) {
-      env->DeleteGlobalRef(obj);
-    }
-    if (str) {
-      delete str;
-    }
-  }
-
   jobject toJ();
 
   NodeKind Kind() { return kind; }
 
-  std::string *AsString() {  // new ref
-    if (!str) {
-      const char methodName[] = "str";
-      JNIEnv *env = getJNIEnv();
-      jstring jstr = (jstring)ObjectMethod(
-          env, methodName, "()Ljava/lang/String;", CLS_JSTR, obj);
-
-      const char *utf = env->GetStringUTFChars(jstr, 0);
-      str = new std::string(utf);
-      env->ReleaseStringUTFChars(jstr, utf);
-    }
-
-    std::string *s = new std::string(*str);
-    return s;
-  }
+  std::string *AsString();  // new ref
+  // readString reads a JVM string to a scratch buffer of the Interface.
+  // The result is valid until the next call.
+  const std::string &readString(JNIEnv *env, jstring jstr);
   int64_t AsInt() {
-    const char methodName[] = "num";
-    JNIEnv *env = getJNIEnv();
-    jmethodID mID = MethodID(env, methodName, "()J", CLS_JINT);
-
-    long long value = (long long)env->CallLongMethod(obj, mID);
-    checkJvmException(std::string("failed to call ")
-                          .append(CLS_JINT)
-                          .append(".")
-                          .append(methodName)
-                          .append(" at Node::AsInt()"));
+    jlong value = LongMethod(getJNIEnv(), MID_JINT_NUM, obj);
     return (int64_t)(value);
   }
   uint64_t AsUint() {
-    const char methodName[] = "get";
-    JNIEnv *env = getJNIEnv();
-    jmethodID mID = MethodID(env, methodName, "()J", CLS_JUINT);
-
-    jlong value = env->CallLongMethod(obj, mID);
-    checkJvmException(std::string("failed to call ")
-                          .append(CLS_JUINT)
-                          .append(".")
-                          .append(methodName)
-                          .append(" at Node::AsUint()"));
+    jlong value = LongMethod(getJNIEnv(), MID_JUINT_GET, obj);
     return (uint64_t)(value);
   }
   double AsFloat() {
-    const char methodName[] = "num";
-    JNIEnv *env = getJNIEnv();
-    jmethodID mID = MethodID(env, methodName, "()D", CLS_JFLT);
-
-    double value = (double)env->CallDoubleMethod(obj, mID);
-    checkJvmException(std::string("failed to call ")
-                          .append(CLS_JFLT)
-                          .append(".")
-                          .append(methodName)
-                          .append(" at Node::AsFloat()"));
-    return value;
+    return (double)DoubleMethod(getJNIEnv(), MID_JFLT_NUM, obj);
   }
   bool AsBool() {
-    const char methodName[] = "value";
-    JNIEnv *env = getJNIEnv();
-    jmethodID mID = MethodID(env, methodName, "()Z", CLS_JBOOL);
-
-    bool value = (bool)env->CallBooleanMethod(obj, mID);
-    checkJvmException(std::string("failed to call ")
-                          .append(CLS_JBOOL)
-                          .append(".")
-                          .append(methodName)
-                          .append(" at Node::AsBool()"));
-    return value;
+    return (bool)BooleanMethod(getJNIEnv(), MID_JBOOL_VALUE, obj);
   }
   size_t Size() {
-    jint size = IntMethod(getJNIEnv(), "size", "()I", CLS_JNODE, obj);
+    jint size = IntMethod(getJNIEnv(), MID_JNODE_SIZE, obj);
     assert(int32_t(size) >= 0);
 
     return size;
@@ -370,73 +802,120 @@ class Node : public uast::Node<Node *> {
     if (!obj || i >= Size()) return nullptr;
 
     JNIEnv *env = getJNIEnv();
-    jstring key = (jstring)ObjectMethod(env, "keyAt", METHOD_JNODE_KEY_AT,
-                                        CLS_JNODE, obj, i);
-
-    const char *k = env->GetStringUTFChars(key, 0);
-    std::string *s = new std::string(k);
-    env->ReleaseStringUTFChars(key, k);
-
-    return s;
+    LocalFrame frame(env);
+    jstring key = (jstring)ObjectMethod(env, MID_JNODE_KEY_AT, obj, (jint)i);
+    return new std::string(readString(env, key));
   }
   // Borrows the reference
   Node *ValueAt(size_t i) {
     if (!obj || i >= Size()) return nullptr;
 
     JNIEnv *env = getJNIEnv();
-    jobject val =
-        ObjectMethod(env, "valueAt", METHOD_JNODE_VALUE_AT, CLS_JNODE, obj, i);
-    return lookupOrCreate(val);
+    LocalFrame frame(env);
+    jobject val = ObjectMethod(env, MID_JNODE_VALUE_AT, obj, (jint)i);
+    return lookupOrCreate(val);  // the node holds a global reference
   }
 
   void SetValue(size_t i, Node *val) {
     JNIEnv *env = getJNIEnv();
-    jobject v = nullptr;
-    if (val && val->obj) {
-      v = val->obj;
-    } else {
-      v = NewJavaObject(env, CLS_JNULL, "()V");
-    }
+    LocalFrame frame(env);
+    jobject v = (val && val->obj) ? val->obj : sharedNull();
+    if (!v) return;
 
-    ObjectMethod(getJNIEnv(), "add", METHOD_JARR_ADD, CLS_JARR, obj, v);
-    checkJvmException(std::string("failed to call ")
-                          .append(CLS_JARR)
-                          .append(".add() from Node::SetValue()"));
+    VoidMethod(env, MID_JARR_ADD, obj, v);
   }
+  jstring internJ(const std::string &s);
+  jobject sharedNull();
+
   void SetKeyValue(std::string key, Node *val) {
     JNIEnv *env = getJNIEnv();
-    jobject v = nullptr;
-    if (val && val->obj) {
-      v = val->obj;
-    } else {
-      v = NewJavaObject(env, CLS_JNULL, "()V");
-    }
+    LocalFrame frame(env);
+    jobject v = (val && val->obj) ? val->obj : sharedNull();
+    if (!v) return;
 
-    jstring k = env->NewStringUTF(key.data());
+    jstring k = internJ(key);
+    if (!k) return;  // OutOfMemoryError is pending
 
-    ObjectMethod(env, "add", METHOD_JOBJ_ADD, CLS_JOBJ, obj, k, v);
-    checkJvmException(
-        std::string("failed to call JObject.add() from Node::SetKeyValue(")
-            .append(key)
-            .append(")"));
+    VoidMethod(env, MID_JOBJ_ADD, obj, k, v);
   }
 };
 
-// Custom comparator for keys in std::map<object>.
-// Compares actual objects instead of JNI references.
-struct EqualByObj {
-  bool operator()(jobject a, jobject b) const {
-    return getJNIEnv()->IsSameObject(a, b);
+// identityHash returns System.identityHashCode() of a JVM object.
+// Borrows the reference.
+jint identityHash(JNIEnv *env, jobject obj) {
+  return StaticIntMethod(env, MID_SYS_IDENTITY_HASH, obj);
+}
+
+// NodeRegistry maps JVM objects to Nodes by object identity.
+//
+// It is an open-addressing hash table with linear probing, keyed by the
+// identity hash of the objects. Objects are only compared with IsSameObject
+// when their identity hashes are equal.
+class NodeRegistry {
+ private:
+  struct Slot {
+    jint hash;
+    Node *node;  // nullptr for empty slots
+  };
+
+  std::vector<Slot> slots;
+  size_t count;
+
+  size_t indexOf(jint hash) const {
+    // spreads the bits of the hash, as the table size is a power of two
+    uint32_t h = uint32_t(hash) * 0x9E3779B9u;
+    return (h ^ (h >> 16)) & (slots.size() - 1);
+  }
+
+  void grow() {
+    std::vector<Slot> old(slots.size() * 2, Slot{0, nullptr});
+    old.swap(slots);
+    for (const Slot &s : old) {
+      if (s.node) place(s);
+    }
+  }
+
+  void place(const Slot &slot) {
+    size_t i = indexOf(slot.hash);
+    while (slots[i].node) {
+      i = (i + 1) & (slots.size() - 1);
+    }
+    slots[i] = slot;
+  }
+
+ public:
+  NodeRegistry() : slots(64, Slot{0, nullptr}), count(0) {}
+
+  // clear unregisters all Nodes. Keeps the capacity of the table, unless it
+  // is larger than maxSlots.
+  void clear(size_t maxSlots) {
+    if (slots.size() > maxSlots) {
+      std::vector<Slot>(64, Slot{0, nullptr}).swap(slots);
+    } else {
+      std::fill(slots.begin(), slots.end(), Slot{0, nullptr});
+    }
+    count = 0;
+  }
+
+  // lookup returns a Node of the given object with the given identity hash,
+  // or nullptr if there is none. Borrows the reference.
+  Node *lookup(JNIEnv *env, jobject obj, jint hash) const {
+    size_t i = indexOf(hash);
+    while (slots[i].node) {
+      if (slots[i].hash == hash && env->IsSameObject(slots[i].node->obj, obj)) {
+        return slots[i].node;
+      }
+      i = (i + 1) & (slots.size() - 1);
+    }
+    return nullptr;
   }
-};
 
-// Custom hasing function for keys in std::map<object>.
-// Delegates actual hasing to the managed .hashCode() impl.
-struct HashByObj {
-  std::size_t operator()(jobject obj) const noexcept {
-    auto hash = IntMethod(getJNIEnv(), "hashCode", "()I", CLS_OBJ, obj);
-    checkJvmException("failed to call hashCode()");
-    return hash;
+  // insert registers a new Node for an object with the given identity hash.
+  void insert(jint hash, Node *node) {
+    // keeps the load factor under 3/4
+    if ((count + 1) * 4 > slots.size() * 3) grow();
+    place(Slot{hash, node});
+    count++;
   }
 };
 
@@ -444,27 +923,40 @@ class Context;
 
 class Interface : public uast::NodeCreator<Node *> {
  private:
-  std::unordered_map<jobject, Node *, HashByObj, EqualByObj> obj2node;
+  NodeRegistry obj2node;
+  // Arenas of all the Nodes and their string values. Nodes are never freed
+  // one by one, so all of them are released at once with the Interface.
+  std::deque<Node> nodes;
+  std::deque<std::string> strings;
+  // Canonical JVM strings for the keys and string values, like "@type" or
+  // "uast:Identifier", that repeat in many nodes. Global references.
+  std::unordered_map<std::string, jstring> jstrings;
+  std::string scratch;
+  // JNull instance used for all null values, JNull is immutable
+  jobject jnull;
 
   // lookupOrCreate either creates a new object or returns existing one.
   // In the second case it creates a new reference.
   Node *lookupOrCreate(jobject obj) {
     if (!obj) return nullptr;
 
-    if (obj2node.count(obj) > 0) {
-      return obj2node[obj];
-    }
+    JNIEnv *env = getJNIEnv();
+    jint hash = identityHash(env, obj);
+    Node *node = obj2node.lookup(env, obj, hash);
+    if (node) return node;
 
-    Node *node = new Node(this, obj);
-    obj2node[node->obj] = node;
+    nodes.emplace_back(this, obj);
+    node = &nodes.back();
+    obj2node.insert(hash, node);
     return node;
   }
 
   // create makes a new object with a specified kind.
   // Creates new reference.
   Node *create(NodeKind kind, jobject obj) {
-    Node *node = new Node(this, kind, obj);
-    obj2node[node->obj] = node;
+    nodes.emplace_back(this, kind, obj);
+    Node *node = &nodes.back();
+    obj2node.insert(identityHash(getJNIEnv(), obj), node);
     return node;
   }
 
@@ -472,13 +964,89 @@ class Interface : public uast::NodeCreator<Node *> {
   friend class Node;
   friend class Context;
 
-  Interface() {}
+  Interface() : jnull(nullptr) {}
   ~Interface() {
-    // Only needs to deallocate Nodes, since they own
-    // the same object as used in the map key.
-    for (auto it : obj2node) {
-      delete (it.second);
+    releaseNodes();
+    releaseStrings();
+    if (jnull) getJNIEnv()->DeleteGlobalRef(jnull);
+  }
+
+  // releaseNodes frees all the Nodes. Nodes own the same objects as used in
+  // the map keys, so only their global references need to be released.
+  // The arenas free the rest.
+  void releaseNodes() {
+    JNIEnv *env = getJNIEnv();
+    for (Node &node : nodes) {
+      if (node.obj) env->DeleteGlobalRef(node.obj);
     }
+    nodes.clear();
+    strings.clear();
+  }
+
+  void releaseStrings() {
+    JNIEnv *env = getJNIEnv();
+    for (const auto &kv : jstrings) {
+      env->DeleteGlobalRef(kv.second);
+    }
+    jstrings.clear();
+  }
+
+  // Reset frees all the Nodes, so the Interface can be reused for another
+  // tree. Keeps the registry capacity and the canonical strings, up to the
+  // given limits, as the next tree likely has the same keys.
+  void Reset(size_t maxSlots, size_t maxStrings) {
+    releaseNodes();
+    obj2node.clear(maxSlots);
+    if (jstrings.size() > maxStrings) releaseStrings();
+  }
+
+  // sharedNull returns the JNull used for all null values, creating it on
+  // the first use. Borrows the reference.
+  jobject sharedNull() {
+    if (jnull) return jnull;
+
+    JNIEnv *env = getJNIEnv();
+    LocalFrame frame(env);
+    jobject local = NewJavaObject(env, INIT_JNULL);
+    if (!local) return nullptr;
+    jnull = env->NewGlobalRef(local);
+    return jnull;
+  }
+
+  // internJ returns the canonical JVM string for a given string, creating it
+  // on the first use. Borrows the reference.
+  jstring internJ(const std::string &s) {
+    auto it = jstrings.find(s);
+    if (it != jstrings.end()) return it->second;
+
+    JNIEnv *env = getJNIEnv();
+    LocalFrame frame(env);
+    jstring local = env->NewStringUTF(s.c_str());
+    if (!local) return nullptr;  // OutOfMemoryError is pending
+
+    jstring ref = (jstring)env->NewGlobalRef(local);
+    if (!ref) return nullptr;
+    jstrings.emplace(s, ref);
+    return ref;
+  }
+
+  // readString reads a JVM string to a reusable buffer, instead of a new
+  // copy made by the JVM. The result is valid until the next call.
+  const std::string &readString(JNIEnv *env, jstring jstr) {
+    jsize len = env->GetStringLength(jstr);
+    jsize utfLen = env->GetStringUTFLength(jstr);
+    // some JVMs write a terminating zero after the region
+    scratch.resize(size_t(utfLen) + 1);
+    env->GetStringUTFRegion(jstr, 0, len, &scratch[0]);
+    scratch.resize(size_t(utfLen));
+    return scratch;
+  }
+
+  // keep moves a string to the arena and returns a pointer to it, that is
+  // valid for the lifetime of the Interface.
+  const std::string *keep(std::string s) {
+    strings.push_back(std::move(s));
+    return &strings.back();
   }
 
   // toJ returns a JVM object associated with a node.
@@ -489,41 +1057,51 @@ class Interface : public uast::NodeCreator<Node *> {
   }
 
   // abstract methods from NodeCreator
+  //
+  // Every new JVM object is only kept alive by the global reference of its
+  // Node, so local references are dropped right after the Node is created.
   Node *NewObject(size_t size) {
-    jobject m = NewJavaObject(getJNIEnv(), CLS_JOBJ, "()V");
-    checkJvmException("failed to create new " + std::string(CLS_JOBJ));
+    JNIEnv *env = getJNIEnv();
+    LocalFrame frame(env);
+    jobject m = NewJavaObject(env, INIT_JOBJ, (jint)size);
     return create(NODE_OBJECT, m);
   }
   Node *NewArray(size_t size) {
-    jobject arr = NewJavaObject(getJNIEnv(), CLS_JARR, "(I)V", size);
-    checkJvmException("failed to create new " + std::string(CLS_JARR));
+    JNIEnv *env = getJNIEnv();
+    LocalFrame frame(env);
+    jobject arr = NewJavaObject(env, INIT_JARR, (jint)size);
     return create(NODE_ARRAY, arr);
   }
   Node *NewString(std::string v) {
     JNIEnv *env = getJNIEnv();
-    jobject str = env->NewStringUTF(v.data());
-    jobject arr = NewJavaObject(env, CLS_JSTR, "(Ljava/lang/String;)V", str);
-    checkJvmException("failed to create new " + std::string(CLS_JSTR));
+    LocalFrame frame(env);
+    jstring str = internJ(v);
+    if (!str) return nullptr;  // OutOfMemoryError is pending
+    jobject arr = NewJavaObject(env, INIT_JSTR, str);
     return create(NODE_STRING, arr);
   }
   Node *NewInt(int64_t v) {
-    jobject i = NewJavaObject(getJNIEnv(), CLS_JINT, "(J)V", v);
-    checkJvmException("failed to create new " + std::string(CLS_JINT));
+    JNIEnv *env = getJNIEnv();
+    LocalFrame frame(env);
+    jobject i = NewJavaObject(env, INIT_JINT, (jlong)v);
     return create(NODE_INT, i);
   }
   Node *NewUint(uint64_t v) {
-    jobject i = NewJavaObject(getJNIEnv(), CLS_JUINT, "(J)V", v);
-    checkJvmException("failed to create new " + std::string(CLS_JUINT));
+    JNIEnv *env = getJNIEnv();
+    LocalFrame frame(env);
+    jobject i = NewJavaObject(env, INIT_JUINT, (jlong)v);
     return create(NODE_UINT, i);
   }
   Node *NewFloat(double v) {
-    jobject i = NewJavaObject(getJNIEnv(), CLS_JFLT, "(D)V", v);
-    checkJvmException("failed to create new " + std::string(CLS_JFLT));
+    JNIEnv *env = getJNIEnv();
+    LocalFrame frame(env);
+    jobject i = NewJavaObject(env, INIT_JFLT, (jdouble)v);
     return create(NODE_FLOAT, i);
   }
   Node *NewBool(bool v) {
-    jobject i = NewJavaObject(getJNIEnv(), CLS_JBOOL, "(Z)V", v);
-    checkJvmException("failed to create new " + std::string(CLS_JBOOL));
+    JNIEnv *env = getJNIEnv();
+    LocalFrame frame(env);
+    jobject i = NewJavaObject(env, INIT_JBOOL, (jboolean)v);
     return create(NODE_BOOL, i);
   }
 };
@@ -532,6 +1110,32 @@ class Interface : public uast::NodeCreator<Node *> {
 // Returns a borrowed reference.
 jobject Node::toJ() { return iface->toJ(this); }
 
+// AsString returns a copy of the string value, that is read from the JVM
+// object only once and kept in the arena of the Interface.
+std::string *Node::AsString() {  // new ref
+  if (!str) {
+    JNIEnv *env = getJNIEnv();
+    LocalFrame frame(env);
+    jstring jstr = (jstring)ObjectMethod(env, MID_JSTR_STR, obj);
+
+    str = iface->keep(readString(env, jstr));
+  }
+
+  return new std::string(*str);
+}
+
+const std::string &Node::readString(JNIEnv *env, jstring jstr) {
+  return iface->readString(env, jstr);
+}
+
+// internJ returns the canonical JVM string for a given string.
+// Borrows the reference.
+jstring Node::internJ(const std::string &s) { return iface->internJ(s); }
+
+// sharedNull returns the JNull used for all null values.
+// Borrows the reference.
+jobject Node::sharedNull() { return iface->sharedNull(); }
+
 // lookupOrCreate either creates a new object or returns existing one.
 // In the second case it creates a new reference.
 Node *Node::lookupOrCreate(jobject obj) { return iface->lookupOrCreate(obj); }
@@ -541,6 +1145,10 @@ class Context {
   Interface *iface;
   uast::PtrInterface<Node *> *impl;
   uast::Context<Node *> *ctx;
+  // guards ctx, the nodes of iface and all iterators over them
+  std::mutex mu;
+  // number of owners: the JVM object and every iterator over the context
+  std::atomic<int> refs;
 
   // toJ returns a JVM object associated with a node.
   // Borrows the reference.
@@ -553,7 +1161,7 @@ class Context {
   Node *toNode(jobject jnode) { return iface->lookupOrCreate(jnode); }
 
  public:
-  Context() {
+  Context() : refs(1) {
     // create a class that makes and tracks UAST nodes
     iface = new Interface();
     // create an implementation that will handle libuast calls
@@ -567,18 +1175,38 @@ class Context {
     delete (iface);
   }
 
+  // Reset frees the tree of the context, so it can be reused. The UAST
+  // context is recreated, as it may refer to the freed nodes.
+  void Reset() {
+    delete (ctx);
+    iface->Reset(1 << 16, 1 << 12);
+    ctx = impl->NewContext();
+    refs = 1;
+  }
+
   // RootNode returns a root UAST node, if set.
   // Returns a borrowed ref
   jobject RootNode() {
+    std::lock_guard<std::mutex> lock(mu);
     Node *root = ctx->RootNode();
     return toJ(root);  // borrowed ref
   }
 
+  // Mutex returns the lock that must be held while using iterators over
+  // this context.
+  std::mutex &Mutex() { return mu; }
+
+  // Retain adds an owner of the context, and Release removes one. The
+  // last owner returns the context to the ContextPool.
+  void Retain() { refs++; }
+  void Release();
+
   // Iterate returns iterator over an external UAST tree.
   // Creates a new reference.
   uast::Iterator<Node *> *Iterate(jobject jnode, TreeOrder order) {
     if (!assertNotContext(jnode)) return nullptr;
 
+    std::lock_guard<std::mutex> lock(mu);
     Node *n = toNode(jnode);
     auto iter = ctx->Iterate(n, order);
     return iter;
@@ -589,38 +1217,214 @@ class Context {
   uast::Iterator<Node *> *Filter(jobject node, std::string query) {
     if (!assertNotContext(node)) return nullptr;
 
+    std::lock_guard<std::mutex> lock(mu);
     Node *unode = toNode(node);
     if (unode == nullptr) unode = ctx->RootNode();
 
     auto it = ctx->Filter(unode, query);
     return it;
   }
+};
 
-  // Encode serializes UAST.
-  // Creates a new reference.
-  jobject Encode(jobject jnode, UastFormat format) {
-    if (!assertNotContext(jnode)) return nullptr;
+// ContextPool keeps released Contexts for reuse, so short-lived managed
+// iterators and filters do not set up and tear down a new Context each.
+//
+// Contexts are released on any thread, including the cleaner, so the pool
+// is shared by all threads.
+class ContextPool {
+ private:
+  std::mutex mu;
+  std::vector<Context *> free;
 
-    Node *n = toNode(jnode);
-    uast::Buffer data = ctx->Encode(n, format);
-    return asJvmBuffer(data);
+ public:
+  // Max number of released Contexts kept for reuse
+  static const size_t MAX_FREE = 16;
+
+  // Acquire returns a reset Context, either a released or a new one.
+  Context *Acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      if (!free.empty()) {
+        Context *c = free.back();
+        free.pop_back();
+        return c;
+      }
+    }
+    return new Context();
   }
 
-  jobject LoadFrom(jobject src) {  // NodeExt
-    JNIEnv *env = getJNIEnv();
-    // NodeExt contains a ctx: ContextExt (JVM ref) and a nativeContext: ContextExt (handle)
-    jobject jCtxExt = ObjectField(env, src, "ctx", FIELD_CTX_EXT);
-    ContextExt *nodeExtCtx = getHandle<ContextExt>(env, jCtxExt, nativeContext);
+  // Put resets a Context that has no owners and keeps it for reuse, or
+  // deletes it if the pool is full.
+  void Put(Context *c) {
+    c->Reset();
 
-    checkJvmException("failed to get NodeExt.ctx");
+    std::lock_guard<std::mutex> lock(mu);
+    if (free.size() < MAX_FREE) {
+      free.push_back(c);
+      return;
+    }
+    delete c;
+  }
+
+  // Clear deletes all the kept Contexts.
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mu);
+    for (Context *c : free) delete c;
+    free.clear();
+  }
+};
 
-    auto sctx = nodeExtCtx->ctx;
-    NodeHandle snode =
-        reinterpret_cast<NodeHandle>(getHandle<NodeHandle>(env, src, "handle"));
-    checkJvmException("failed to get NodeExt.handle");
+ContextPool contextPool;
+
+// Release removes an owner of the context. The last one returns it to the
+// pool.
+void Context::Release() {
+  if (--refs == 0) contextPool.Put(this);
+}
+
+// Native state of UastIter.
+//
+// Keeps the Context that owns the iterated nodes, and holds its lock while
+// using the iterator.
+class Iter {
+ public:
+  uast::Iterator<Node *> *iter;
+  Context *ctx;
 
-    Node *node = uast::Load(sctx, snode, ctx);
-    return toJ(node);
+  Iter(uast::Iterator<Node *> *it, Context *c) : iter(it), ctx(c) {
+    ctx->Retain();
+  }
+  ~Iter() {
+    {
+      std::lock_guard<std::mutex> lock(ctx->Mutex());
+      delete (iter);
+    }
+    ctx->Release();
+  }
+
+  // next advances the iterator and returns a JVM object of the next node,
+  // or null at the end of the iteration. Borrows the reference.
+  jobject next() {
+    if (!iter) return nullptr;
+
+    std::lock_guard<std::mutex> lock(ctx->Mutex());
+    if (!iter->next()) return nullptr;
+
+    Node *node = iter->node();
+    if (!node) return nullptr;
+    return node->toJ();
+  }
+};
+
+// WorkerPool runs tasks on native threads, that are started on first use
+// and kept for the next tasks. The threads never call the JVM.
+class WorkerPool {
+ private:
+  std::mutex mu;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> tasks;
+  std::vector<std::thread> threads;
+  bool stopped;
+
+  void loop() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mu);
+        cv.wait(lock, [this] { return stopped || !tasks.empty(); });
+        if (stopped) return;
+
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+ public:
+  // Max number of threads, whatever the requested parallelism
+  static const size_t MAX_THREADS = 64;
+
+  WorkerPool() : stopped(false) {}
+
+  // Submit queues a task, and starts threads until there are at least a
+  // given number of them. If no thread can be started, the task may never
+  // run, so callers must not wait for a task to start.
+  void Submit(std::function<void()> task, size_t minThreads) {
+    std::lock_guard<std::mutex> lock(mu);
+    if (stopped) return;
+
+    minThreads = std::min(minThreads, size_t(MAX_THREADS));
+    while (threads.size() < minThreads) {
+      try {
+        threads.emplace_back(&WorkerPool::loop, this);
+      } catch (const std::system_error &) {
+        break;  // the threads that did start run the tasks
+      }
+    }
+    tasks.push_back(std::move(task));
+    cv.notify_one();
+  }
+
+  // Stop drops the queued tasks and joins all the threads.
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      stopped = true;
+      tasks.clear();
+    }
+    cv.notify_all();
+    for (auto &t : threads) t.join();
+    threads.clear();
+  }
+};
+
+// Shared by all the calls of decodeAll. Never deleted, so no joinable thread
+// is destroyed at exit, it is only stopped when the library is unloaded.
+WorkerPool &decodePool() {
+  static WorkerPool *pool = new WorkerPool();
+  return *pool;
+}
+
+// DecodeBatch is the state of a single decodeAll call, shared with the
+// pool tasks that help to decode it. A task that starts after all the
+// buffers are taken returns at once, so the caller only waits for the
+// buffers to be decoded, not for its tasks to run.
+class DecodeBatch {
+ private:
+  std::mutex mu;
+  std::condition_variable cv;
+  size_t done;
+  std::atomic<size_t> next;
+
+ public:
+  const std::vector<uast::Buffer> bufs;
+  const UastFormat format;
+  std::vector<uast::Context<NodeHandle> *> ctxs;
+  std::vector<std::string> errs;
+
+  DecodeBatch(std::vector<uast::Buffer> b, UastFormat f)
+      : done(0), next(0), bufs(std::move(b)), format(f),
+        ctxs(bufs.size(), nullptr), errs(bufs.size()) {}
+
+  // Work decodes the next buffers until all of them are taken.
+  void Work() {
+    for (size_t i = next++; i < bufs.size(); i = next++) {
+      try {
+        ctxs[i] = uast::Decode(bufs[i], format);
+      } catch (const std::exception &e) {
+        errs[i] = e.what();
+      }
+
+      std::lock_guard<std::mutex> lock(mu);
+      if (++done == bufs.size()) cv.notify_all();
+    }
+  }
+
+  // Wait blocks until all the buffers are decoded.
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mu);
+    cv.wait(lock, [this] { return done == bufs.size(); });
   }
 };
 
@@ -630,6 +1434,32 @@ class Context {
 //          v2.libuast.Libuast
 // ==========================================
 
+// Max size of the scratch buffer that decodeBytes keeps for the next calls
+// on the same thread. Larger ones are freed after use.
+const size_t MAX_DECODE_SCRATCH = 4 << 20;
+
+// Per-thread copy of the array range decoded by decodeBytes. libuast copies
+// the bytes while decoding, so it is reused by the next call.
+thread_local std::vector<char> decodeScratch;
+
+// Wraps a decoded external UAST into a new JVM ContextExt.
+// Takes ownership of the context.
+jobject newContextExt(JNIEnv *env, uast::Context<NodeHandle> *ctx) {
+  ContextExt *p = new ContextExt(ctx);
+
+  jobject jCtxExt = NewJavaObject(env, INIT_CTX_EXT, p);
+  if (env->ExceptionCheck() || !jCtxExt) {
+    // This also deletes the underlying ctx
+    delete (p);
+    checkJvmException("failed to instantiate ContextExt class");
+    return nullptr;
+  }
+
+  // Saves weak reference to JVM ContextExt in the native ContextExt
+  p->setManagedContext(jCtxExt);
+  return jCtxExt;
+}
+
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_libuast_Libuast_decode(
     JNIEnv *env, jobject self, jobject directBuf, jint fmt) {
   UastFormat format = (UastFormat) fmt;
@@ -640,60 +1470,156 @@ JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_libuast_Libuast_decode(
 
   jlong len = env->GetDirectBufferCapacity(directBuf);
   checkJvmException("failed to get buffer capacity");
-  jobject jCtxExt = nullptr;
 
   try {
-      // another option (instead of XXX) is to use
-      // GetPrimitiveArrayCritical
-      // Note the content of buf will be released by the JVM itself
-      uast::Buffer ubuf(buf, (size_t)(len));
-      uast::Context<NodeHandle> *ctx = uast::Decode(ubuf, format);
-      // ReleasePrimitiveArrayCritical
+    // Note the content of buf will be released by the JVM itself
+    uast::Buffer ubuf(buf, (size_t)(len));
+    return newContextExt(env, uast::Decode(ubuf, format));
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return nullptr;
+  }
+}
 
-      ContextExt *p = new ContextExt(ctx);
+JNIEXPORT jobjectArray JNICALL
+Java_org_bblfsh_client_v2_libuast_Libuast_decodeAll(JNIEnv *env, jobject self,
+                                                    jobjectArray directBufs,
+                                                    jintArray lens, jint fmt,
+                                                    jint parallelism) {
+  UastFormat format = (UastFormat)fmt;
+  jsize n = env->GetArrayLength(directBufs);
+  if (env->GetArrayLength(lens) != n) {
+    ThrowByName(env, CLS_RE, "expected a length for each buffer");
+    return nullptr;
+  }
 
-      jCtxExt = NewJavaObject(env, CLS_CTX_EXT, "(J)V", p);
+  std::vector<jint> sizes(n);
+  env->GetIntArrayRegion(lens, 0, n, sizes.data());
+  if (env->ExceptionCheck()) return nullptr;
 
-      // Saves weak reference to JVM ContextExt in the native ContextExt
-      p->setManagedContext(jCtxExt);
+  // works only with ByteBuffer.allocateDirect()
+  std::vector<uast::Buffer> bufs;
+  bufs.reserve(n);
+  for (jsize i = 0; i < n; i++) {
+    jobject buf = env->GetObjectArrayElement(directBufs, i);
+    void *ptr = buf ? env->GetDirectBufferAddress(buf) : nullptr;
+    jlong capacity = buf ? env->GetDirectBufferCapacity(buf) : -1;
+    env->DeleteLocalRef(buf);
+    if (!ptr || sizes[i] < 0 || capacity < sizes[i]) {
+      ThrowByName(env, CLS_RE, "failed to use buffer for direct access");
+      return nullptr;
+    }
+    bufs.push_back(uast::Buffer(ptr, (size_t)sizes[i]));
+  }
 
-      if (env->ExceptionCheck() || !jCtxExt) {
-          jCtxExt = nullptr;
-          // This also deletes the underlying ctx
-          delete (p);
-          checkJvmException("failed to instantiate ContextExt class");
-      }
+  // Decodes on this thread and up to parallelism - 1 pool threads, without
+  // any JNI calls.
+  auto batch = std::make_shared<DecodeBatch>(std::move(bufs), format);
+  jsize helpers = std::min(jsize(parallelism), n) - 1;
+  for (jsize i = 0; i < helpers; i++) {
+    decodePool().Submit([batch]() { batch->Work(); }, size_t(helpers));
+  }
+  batch->Work();
+  batch->Wait();
+  std::vector<uast::Context<NodeHandle> *> &ctxs = batch->ctxs;
+  std::vector<std::string> &errs = batch->errs;
+
+  // Wraps the results in input order, or fails the whole batch.
+  auto deleteFrom = [&](jsize from) {
+    for (jsize i = from; i < n; i++) delete (ctxs[i]);
+  };
+  for (jsize i = 0; i < n; i++) {
+    if (!ctxs[i]) {
+      std::string err = errs[i].empty() ? "failed to decode UAST" : errs[i];
+      deleteFrom(0);
+      ThrowByName(env, CLS_RE, err.c_str());
+      return nullptr;
+    }
+  }
+
+  jobjectArray res = env->NewObjectArray(n, CLASS_CTX_EXT.ref, nullptr);
+  if (!res) {
+    deleteFrom(0);
+    return nullptr;  // OutOfMemoryError is pending
+  }
+  for (jsize i = 0; i < n; i++) {
+    jobject jCtxExt = newContextExt(env, ctxs[i]);  // takes ownership
+    if (!jCtxExt) {
+      deleteFrom(i + 1);
+      return nullptr;
+    }
+    env->SetObjectArrayElement(res, i, jCtxExt);
+    env->DeleteLocalRef(jCtxExt);
+  }
+  return res;
+}
+
+JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_libuast_Libuast_decodeBytes(
+    JNIEnv *env, jobject self, jbyteArray bytes, jint offset, jint len,
+    jint fmt) {
+  UastFormat format = (UastFormat)fmt;
+
+  jsize size = env->GetArrayLength(bytes);
+  if (offset < 0 || len < 0 || offset > size - len) {
+    ThrowByName(env, CLS_RE, "decode range is out of the array bounds");
+    return nullptr;
+  }
+
+  // Copies the range out of the JVM heap first, so the GC is not blocked
+  // for the whole decode, as it would be by a critical region.
+  std::vector<char> &scratch = decodeScratch;
+  scratch.resize((size_t)len);
+  env->GetByteArrayRegion(bytes, offset, len, (jbyte *)scratch.data());
+  if (env->ExceptionCheck()) return nullptr;
+
+  uast::Context<NodeHandle> *ctx = nullptr;
+  std::string err;
+  try {
+    uast::Buffer ubuf(scratch.data(), (size_t)(len));
+    ctx = uast::Decode(ubuf, format);
   } catch (const std::exception &e) {
-    ThrowByName(env, CLS_RE, e.what());
+    err = e.what();
+  }
+  if (scratch.capacity() > MAX_DECODE_SCRATCH) {
+    std::vector<char>().swap(scratch);
   }
 
-  return jCtxExt;
+  if (!ctx) {
+    ThrowByName(env, CLS_RE, err.empty() ? "failed to decode UAST" : err.c_str());
+    return nullptr;
+  }
+  return newContextExt(env, ctx);
 }
 
 // UastIter
 JNIEXPORT void JNICALL
 Java_org_bblfsh_client_v2_libuast_Libuast_00024UastIter_nativeInit(
     JNIEnv *env, jobject self) {
-  jobject jnode = ObjectField(env, self, "node", FIELD_ITER_NODE);
+  jobject jnode = ObjectField(env, self, FID_ITER_NODE);
   if (!jnode) {
     return;
   }
 
-  Context *ctx = new Context();
-  jobject jCtx = NewJavaObject(env, CLS_CTX, "(J)V", ctx);
-
-  jint order = IntField(env, self, "treeOrder", "I");
+  jint order = IntField(env, self, FID_ITER_ORDER);
   if (order < 0) {
     return;
   }
 
+  Context *ctx = contextPool.Acquire();
+  jobject jCtx = NewJavaObject(env, INIT_CTX, ctx);
+  if (env->ExceptionCheck() || !jCtx) {
+    ctx->Release();
+    checkJvmException("failed to instantiate Context class");
+    return;
+  }
+
   // global ref will be deleted by Interface destructor on ctx deletion
   auto it = ctx->Iterate(jnode, (TreeOrder)order);
 
   // this.iter = it;
-  setHandle<uast::Iterator<Node *>>(env, self, it, "iter");
+  setHandle<Iter>(env, self, new Iter(it, ctx), FID_ITER_PTR);
   // this.ctx = Context(ctx);
-  setObjectField(env, self, jCtx, "ctx", FIELD_CTX);
+  SetObjectField(env, self, FID_JITER_CTX, jCtx);
 
   return;
 }
@@ -701,12 +1627,13 @@ Java_org_bblfsh_client_v2_libuast_Libuast_00024UastIter_nativeInit(
 JNIEXPORT void JNICALL
 Java_org_bblfsh_client_v2_libuast_Libuast_00024UastIter_nativeDispose(
     JNIEnv *env, jobject self) {
-  // this.ctx will be disposed by Context finalizer
-  setObjectField(env, self, nullptr, "ctx", FIELD_CTX);
+  // this.ctx is freed by its own close() or cleaner, the iterator keeps
+  // the native context alive until it is deleted
+  SetObjectField(env, self, FID_JITER_CTX, nullptr);
 
   // this.iter
-  auto iter = getHandle<uast::Iterator<Node *>>(env, self, "iter");
-  setHandle<uast::Iterator<Node *>>(env, self, 0, "iter");
+  auto iter = getHandle<Iter>(env, self, FID_ITER_PTR);
+  setHandle<Iter>(env, self, 0, FID_ITER_PTR);
   delete (iter);
   return;
 }
@@ -715,21 +1642,34 @@ JNIEXPORT jobject JNICALL
 Java_org_bblfsh_client_v2_libuast_Libuast_00024UastIter_nativeNext(
     JNIEnv *env, jobject self, jlong iterPtr) {
   // this.iter
-  auto iter = reinterpret_cast<uast::Iterator<Node *> *>(iterPtr);
+  auto iter = reinterpret_cast<Iter *>(iterPtr);
+  if (!iter) return nullptr;
 
   try {
-    if (!iter->next()) {
-      return nullptr;
-    }
+    return iter->next();  // borrows ref
   } catch (const std::exception &e) {
     ThrowByName(env, CLS_RE, e.what());
     return nullptr;
   }
+}
 
-  Node *node = iter->node();
-  if (!node) return nullptr;
+JNIEXPORT jint JNICALL
+Java_org_bblfsh_client_v2_libuast_Libuast_00024UastIter_nativeNextBatch(
+    JNIEnv *env, jobject self, jlong iterPtr, jobjectArray out) {
+  // this.iter
+  auto iter = reinterpret_cast<Iter *>(iterPtr);
+  if (!iter) return 0;
 
-  return node->toJ();  // borrows ref
+  try {
+    return nextBatch(env, out, [&]() -> jobject {
+      jobject node = iter->next();
+      // next borrows the global ref, the array gets a new local one
+      return node ? env->NewLocalRef(node) : nullptr;
+    });
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return 0;
+  }
 }
 
 // UastIterExt
@@ -737,29 +1677,31 @@ JNIEXPORT void JNICALL
 Java_org_bblfsh_client_v2_libuast_Libuast_00024UastIterExt_nativeInit(
     JNIEnv *env, jobject self) {  // sets iter and ctx, given node: NodeExt
 
-  jobject nodeExt = ObjectField(env, self, "node", FIELD_ITER_NODE);
+  jobject nodeExt = ObjectField(env, self, FID_ITER_NODE);
   if (!nodeExt) {
     return;
   }
 
-  jobject jCtxExt = ObjectField(env, nodeExt, "ctx", FIELD_CTX_EXT);
+  jobject jCtxExt = ObjectField(env, nodeExt, FID_NODE_CTX);
   if (!jCtxExt)
     return;
 
-  // borrow ContextExt from NodeExt
-  ContextExt *ctx = getHandle<ContextExt>(env, jCtxExt, nativeContext);
-
-  jint order = IntField(env, self, "treeOrder", "I");
+  jint order = IntField(env, self, FID_ITER_ORDER);
   if (order < 0) {
     return;
   }
 
+  // borrow ContextExt from NodeExt
+  Retained<ContextExt> ctx(env, jCtxExt, FID_CTX_EXT_NATIVE);
+  if (!ctx) return;
+
   auto it = ctx->Iterate(nodeExt, (TreeOrder)order);
+  if (!it) return;
 
   // this.iter = it;
-  setHandle<uast::Iterator<NodeHandle>>(env, self, it, "iter");
+  setHandle<IterExt>(env, self, new IterExt(it, ctx.get()), FID_ITER_PTR);
   // this.ctx = jCtxExt;
-  setObjectField(env, self, jCtxExt, "ctx", FIELD_CTX_EXT);
+  SetObjectField(env, self, FID_ITER_CTX_EXT, jCtxExt);
 
   return;
 }
@@ -767,12 +1709,13 @@ Java_org_bblfsh_client_v2_libuast_Libuast_00024UastIterExt_nativeInit(
 JNIEXPORT void JNICALL
 Java_org_bblfsh_client_v2_libuast_Libuast_00024UastIterExt_nativeDispose(
     JNIEnv *env, jobject self) {
-  // this.ctx will be disposed by ContextExt finalizer
-  setObjectField(env, self, nullptr, "ctx", FIELD_CTX_EXT);
+  // this.ctx is freed by its own close() or cleaner, the iterator keeps
+  // the native context alive until it is deleted
+  SetObjectField(env, self, FID_ITER_CTX_EXT, nullptr);
 
   // this.iter
-  auto iter = getHandle<uast::Iterator<NodeHandle>>(env, self, "iter");
-  setHandle<uast::Iterator<NodeHandle>>(env, self, 0, "iter");
+  auto iter = getHandle<IterExt>(env, self, FID_ITER_PTR);
+  setHandle<IterExt>(env, self, 0, FID_ITER_PTR);
   delete (iter);
   return;
 }
@@ -781,23 +1724,30 @@ JNIEXPORT jobject JNICALL
 Java_org_bblfsh_client_v2_libuast_Libuast_00024UastIterExt_nativeNext(
     JNIEnv *env, jobject self, jlong iterPtr) {
   // this.iter
-  auto iter = reinterpret_cast<uast::Iterator<NodeHandle> *>(iterPtr);
+  auto iter = reinterpret_cast<IterExt *>(iterPtr);
+  if (!iter) return nullptr;
 
   try {
-    if (!iter->next()) {
-      return nullptr;
-    }
+    return iter->next();
   } catch (const std::exception &e) {
     ThrowByName(env, CLS_RE, e.what());
     return nullptr;
   }
+}
 
-  NodeHandle node = iter->node();
-  if (node == 0) return nullptr;
+JNIEXPORT jint JNICALL
+Java_org_bblfsh_client_v2_libuast_Libuast_00024UastIterExt_nativeNextBatch(
+    JNIEnv *env, jobject self, jlong iterPtr, jobjectArray out) {
+  // this.iter
+  auto iter = reinterpret_cast<IterExt *>(iterPtr);
+  if (!iter) return 0;
 
-  jobject jCtxExt = ObjectField(env, self, "ctx", FIELD_CTX_EXT);
-  ContextExt *ctx = getHandle<ContextExt>(env, jCtxExt, nativeContext);
-  return ctx->lookup(node);
+  try {
+    return nextBatch(env, out, [&]() { return iter->next(); });
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return 0;
+  }
 }
 
 // ==========================================
@@ -805,12 +1755,12 @@ Java_org_bblfsh_client_v2_libuast_Libuast_00024UastIterExt_nativeNext(
 // ==========================================
 
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_Context_filter(
-    JNIEnv *env, jobject self, jstring jquery, jobject jnode) {
-  Context *ctx = getHandle<Context>(env, self, nativeContext);
+    JNIEnv *env, jobject self, jobject jquery, jobject jnode) {
+  Retained<Context> ctx(env, self, FID_CTX_NATIVE);
+  if (!ctx) return nullptr;
 
-  const char *q = env->GetStringUTFChars(jquery, 0);
-  std::string query = std::string(q);
-  env->ReleaseStringUTFChars(jquery, q);
+  std::string query;
+  if (!toQuery(env, jquery, &query)) return nullptr;
 
   uast::Iterator<Node *> *it = nullptr;
   try {
@@ -820,37 +1770,82 @@ JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_Context_filter(
     return nullptr;
   }
 
+  Iter *state = new Iter(it, ctx.get());
+
   // new UastIter()
-  jobject iter =
-      NewJavaObject(env, CLS_JITER, METHOD_JITER_INIT, 0, 0, it, self);
+  jobject iter = NewJavaObject(env, INIT_JITER, 0, 0, state, self);
   if (env->ExceptionCheck() || !iter) {
-    delete (it);
+    delete (state);
     checkJvmException("failed create new UastIter class");
   }
   return iter;
 }
 
-JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_Context_nativeEncode(
-    JNIEnv *env, jobject self, jobject jnode, jint fmt) {
-  UastFormat format = (UastFormat) fmt;  // TODO(#107): make it argument
-
-  Context *p = getHandle<Context>(env, self, nativeContext);
-  return p->Encode(jnode, format);
-}
-
 JNIEXPORT jlong JNICALL
 Java_org_bblfsh_client_v2_Context_00024_create(JNIEnv *env, jobject self) {
-  auto c = new Context();
+  auto c = contextPool.Acquire();
   return (long)c;
 }
 
-JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_Context_dispose(JNIEnv *env,
-                                                                 jobject self) {
-  Context *p = getHandle<Context>(env, self, nativeContext);
+// Reads a tree in the flat layout out of the first len bytes of a direct
+// buffer, and encodes it with no JNI calls per node.
+uast::Buffer encodeFlat(JNIEnv *env, jobject directBuf, jint len,
+                        UastFormat format) {
+  // works only with ByteBuffer.allocateDirect()
+  const char *buf = (const char *)env->GetDirectBufferAddress(directBuf);
+  if (!buf || len < 0 || env->GetDirectBufferCapacity(directBuf) < len) {
+    throw std::runtime_error("failed to use buffer for direct access");
+  }
+
+  FlatContext ctx;
+  FlatNode *root = ctx.Tree()->Parse(buf, (size_t)len);
+  return ctx.Ctx()->Encode(root, format);
+}
+
+JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_Context_00024_encodeFlat(
+    JNIEnv *env, jobject self, jobject directBuf, jint len, jint fmt,
+    jobject pool) {
+  try {
+    uast::Buffer data = encodeFlat(env, directBuf, len, (UastFormat)fmt);
+    return asPooledBuffer(data, pool);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return nullptr;
+  }
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_org_bblfsh_client_v2_Context_00024_encodeFlatToArray(JNIEnv *env,
+                                                          jobject self,
+                                                          jobject directBuf,
+                                                          jint len, jint fmt) {
+  try {
+    uast::Buffer data = encodeFlat(env, directBuf, len, (UastFormat)fmt);
+    return asJvmArray(data);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return nullptr;
+  }
+}
+
+JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_Context_00024_encodeFlatTo(
+    JNIEnv *env, jobject self, jobject directBuf, jint len, jint fmt,
+    jobject sink) {
+  try {
+    uast::Buffer data = encodeFlat(env, directBuf, len, (UastFormat)fmt);
+    streamTo(data, sink);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+  }
+}
+
+JNIEXPORT void JNICALL
+Java_org_bblfsh_client_v2_Context_nativeDispose(JNIEnv *env, jobject self) {
+  Context *p = getHandle<Context>(env, self, FID_CTX_NATIVE);
 
   if (p) {
-    delete p;
-    setHandle<Context>(env, self, 0, nativeContext);
+    setHandle<Context>(env, self, 0, FID_CTX_NATIVE);
+    p->Release();
   }
 };
 
@@ -860,30 +1855,183 @@ JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_Context_dispose(JNIEnv *env,
 
 JNIEXPORT jobject JNICALL
 Java_org_bblfsh_client_v2_ContextExt_root(JNIEnv *env, jobject self) {
-  ContextExt *p = getHandle<ContextExt>(env, self, nativeContext);
-  return p->RootNode();
+  Retained<ContextExt> ctx(env, self, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+  return ctx->RootNode();
 }
 
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_ContextExt_filter(
-    JNIEnv *env, jobject self, jstring jquery) {
-  ContextExt *ctx = getHandle<ContextExt>(env, self, nativeContext);
-  return filterUastIterExt(ctx, self, jquery, env);
+    JNIEnv *env, jobject self, jobject jquery) {
+  Retained<ContextExt> ctx(env, self, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+  return filterUastIterExt(ctx.get(), self, jquery, env);
+}
+
+JNIEXPORT jlongArray JNICALL Java_org_bblfsh_client_v2_ContextExt_filterHandles(
+    JNIEnv *env, jobject self, jobject jquery) {
+  Retained<ContextExt> ctx(env, self, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+
+  std::string query;
+  if (!toQuery(env, jquery, &query)) return nullptr;
+
+  try {
+    return ctx->FilterHandles(query);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return nullptr;
+  }
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_org_bblfsh_client_v2_ContextExt_nativeFilterMany(JNIEnv *env, jobject self,
+                                                      jobjectArray jqueries) {
+  Retained<ContextExt> ctx(env, self, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+
+  jsize n = env->GetArrayLength(jqueries);
+  std::vector<std::string> queries(n);
+  for (jsize i = 0; i < n; i++) {
+    jobject jquery = env->GetObjectArrayElement(jqueries, i);
+    bool ok = toQuery(env, jquery, &queries[i]);
+    env->DeleteLocalRef(jquery);
+    if (!ok) return nullptr;
+  }
+
+  try {
+    return ctx->FilterMany(queries);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return nullptr;
+  }
+}
+
+// Aggregations shared by ContextExt and NodeExt, node zero means the root.
+
+jlong count(JNIEnv *env, ContextExt *ctx, NodeHandle node, jobject jquery) {
+  std::string query;
+  if (!toQuery(env, jquery, &query)) return 0;
+
+  try {
+    return ctx->Count(node, query);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return 0;
+  }
+}
+
+jboolean exists(JNIEnv *env, ContextExt *ctx, NodeHandle node, jobject jquery) {
+  std::string query;
+  if (!toQuery(env, jquery, &query)) return JNI_FALSE;
+
+  try {
+    return ctx->Exists(node, query) ? JNI_TRUE : JNI_FALSE;
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return JNI_FALSE;
+  }
+}
+
+jobjectArray countBy(JNIEnv *env, ContextExt *ctx, NodeHandle node,
+                     jstring jfield) {
+  const char *f = env->GetStringUTFChars(jfield, 0);
+  std::string field = std::string(f);
+  env->ReleaseStringUTFChars(jfield, f);
+
+  try {
+    return ctx->CountBy(node, field);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return nullptr;
+  }
+}
+
+JNIEXPORT jlong JNICALL Java_org_bblfsh_client_v2_ContextExt_count(
+    JNIEnv *env, jobject self, jobject jquery) {
+  Retained<ContextExt> ctx(env, self, FID_CTX_EXT_NATIVE);
+  if (!ctx) return 0;
+  return count(env, ctx.get(), 0, jquery);
+}
+
+JNIEXPORT jboolean JNICALL Java_org_bblfsh_client_v2_ContextExt_exists(
+    JNIEnv *env, jobject self, jobject jquery) {
+  Retained<ContextExt> ctx(env, self, FID_CTX_EXT_NATIVE);
+  if (!ctx) return JNI_FALSE;
+  return exists(env, ctx.get(), 0, jquery);
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_org_bblfsh_client_v2_ContextExt_nativeCountBy(JNIEnv *env, jobject self,
+                                                   jstring jfield) {
+  Retained<ContextExt> ctx(env, self, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+  return countBy(env, ctx.get(), 0, jfield);
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_org_bblfsh_client_v2_ContextExt_nativeToColumns(JNIEnv *env, jobject self,
+                                                     jobject pool) {
+  Retained<ContextExt> ctx(env, self, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+
+  try {
+    return ctx->ToColumns(pool);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return nullptr;
+  }
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_org_bblfsh_client_v2_ContextExt_nativeIterateHandles(JNIEnv *env,
+                                                          jobject self,
+                                                          jint order) {
+  Retained<ContextExt> ctx(env, self, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+
+  try {
+    return ctx->IterateHandles((TreeOrder)order);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return nullptr;
+  }
 }
 
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_ContextExt_nativeEncode(
-    JNIEnv *env, jobject self, jobject node, jint fmt) {
+    JNIEnv *env, jobject self, jobject node, jint fmt, jobject pool) {
   UastFormat format = (UastFormat) fmt;
 
-  ContextExt *p = getHandle<ContextExt>(env, self, nativeContext);
-  return p->Encode(node, format);
+  Retained<ContextExt> ctx(env, self, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+
+  try {
+    return ctx->Encode(node, format, pool);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return nullptr;
+  }
+}
+
+JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_ContextExt_nativeEncodeTo(
+    JNIEnv *env, jobject self, jobject node, jint fmt, jobject sink) {
+  UastFormat format = (UastFormat) fmt;
+
+  Retained<ContextExt> ctx(env, self, FID_CTX_EXT_NATIVE);
+  if (!ctx) return;
+
+  try {
+    ctx->EncodeTo(node, format, sink);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+  }
 }
 
 JNIEXPORT void JNICALL
-Java_org_bblfsh_client_v2_ContextExt_dispose(JNIEnv *env, jobject self) {
-  ContextExt *p = getHandle<ContextExt>(env, self, nativeContext);
+Java_org_bblfsh_client_v2_ContextExt_nativeDispose(JNIEnv *env, jobject self) {
+  ContextExt *p = getHandle<ContextExt>(env, self, FID_CTX_EXT_NATIVE);
   if (p) {
-    delete p;
-    setHandle<ContextExt>(env, self, 0, nativeContext);
+    setHandle<ContextExt>(env, self, 0, FID_CTX_EXT_NATIVE);
+    p->Release();
   }
 }
 
@@ -891,27 +2039,175 @@ Java_org_bblfsh_client_v2_ContextExt_dispose(JNIEnv *env, jobject self) {
 //                v2.Node()
 // ==========================================
 
-JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_NodeExt_load(JNIEnv *env,
-                                                                 jobject self) {
-  auto ctx = new Context();
-  jobject node = ctx->LoadFrom(self);
-  // We need to make a local reference to node since ctx is going to be destroyed
-  // before returning, and the global references that each Node carries with it.
-  // If we do not copy node in a local ref, we return a null, whereas copying it in
-  // a local ref ensures the native part returns the value to Scala and after that
-  // disposes of the local refs
-  jobject result = getJNIEnv()->NewLocalRef(node);
-  delete (ctx);
-  return result;
+JNIEXPORT jbyteArray JNICALL
+Java_org_bblfsh_client_v2_NodeExt_nativeLoad(JNIEnv *env, jobject self) {
+  jobject jCtxExt = ObjectField(env, self, FID_NODE_CTX);
+  Retained<ContextExt> ctx(env, jCtxExt, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+
+  try {
+    return ctx->LoadFlat(self);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return nullptr;
+  }
+}
+
+JNIEXPORT jobject JNICALL
+Java_org_bblfsh_client_v2_NodeExt_nativeView(JNIEnv *env, jobject self) {
+  jobject jCtxExt = ObjectField(env, self, FID_NODE_CTX);
+  Retained<ContextExt> ctx(env, jCtxExt, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+
+  try {
+    return ctx->View(self);
+  } catch (const std::exception &e) {
+    ThrowByName(env, CLS_RE, e.what());
+    return nullptr;
+  }
+}
+
+JNIEXPORT jlong JNICALL Java_org_bblfsh_client_v2_NodeExt_count(
+    JNIEnv *env, jobject self, jobject jquery) {
+  jobject jCtxExt = ObjectField(env, self, FID_NODE_CTX);
+  Retained<ContextExt> ctx(env, jCtxExt, FID_CTX_EXT_NATIVE);
+  if (!ctx) return 0;
+  NodeHandle node = (NodeHandle)LongField(env, self, FID_NODE_HANDLE);
+  return count(env, ctx.get(), node, jquery);
+}
+
+JNIEXPORT jboolean JNICALL Java_org_bblfsh_client_v2_NodeExt_exists(
+    JNIEnv *env, jobject self, jobject jquery) {
+  jobject jCtxExt = ObjectField(env, self, FID_NODE_CTX);
+  Retained<ContextExt> ctx(env, jCtxExt, FID_CTX_EXT_NATIVE);
+  if (!ctx) return JNI_FALSE;
+  NodeHandle node = (NodeHandle)LongField(env, self, FID_NODE_HANDLE);
+  return exists(env, ctx.get(), node, jquery);
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_org_bblfsh_client_v2_NodeExt_nativeCountBy(JNIEnv *env, jobject self,
+                                                jstring jfield) {
+  jobject jCtxExt = ObjectField(env, self, FID_NODE_CTX);
+  Retained<ContextExt> ctx(env, jCtxExt, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+  NodeHandle node = (NodeHandle)LongField(env, self, FID_NODE_HANDLE);
+  return countBy(env, ctx.get(), node, jfield);
 }
 
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_NodeExt_filter(
+    JNIEnv *env, jobject self, jobject jquery) {
+  jobject jCtxExt = ObjectField(env, self, FID_NODE_CTX);
+  Retained<ContextExt> ctx(env, jCtxExt, FID_CTX_EXT_NATIVE);
+  if (!ctx) return nullptr;
+  return filterUastIterExt(ctx.get(), jCtxExt, jquery, env);
+}
+
+
+// ==========================================
+//              v2.LazyContext()
+// ==========================================
+
+JNIEXPORT jbyteArray JNICALL Java_org_bblfsh_client_v2_LazyContext_expand(
+    JNIEnv *env, jobject self, jlong node) {
+  // close() is synchronized on the same monitor
+  if (env->MonitorEnter(self) != JNI_OK) return nullptr;
+
+  jbyteArray res = nullptr;
+  LazyContext *p = getHandle<LazyContext>(env, self, FID_LAZY_CTX_NATIVE);
+  if (!p) {
+    ThrowByName(env, CLS_RE, "LazyContext is already disposed");
+  } else {
+    try {
+      res = p->Expand(node);
+    } catch (const std::exception &e) {
+      ThrowByName(env, CLS_RE, e.what());
+    }
+  }
+
+  env->MonitorExit(self);
+  return res;
+}
+
+JNIEXPORT void JNICALL
+Java_org_bblfsh_client_v2_LazyContext_nativeDispose(JNIEnv *env, jobject self) {
+  LazyContext *p = getHandle<LazyContext>(env, self, FID_LAZY_CTX_NATIVE);
+  if (p) {
+    delete p;
+    setHandle<LazyContext>(env, self, 0, FID_LAZY_CTX_NATIVE);
+  }
+}
+
+// ==========================================
+//              v2.PreparedQuery()
+// ==========================================
+
+JNIEXPORT jlong JNICALL Java_org_bblfsh_client_v2_PreparedQuery_00024_prepare(
     JNIEnv *env, jobject self, jstring jquery) {
-  jobject jCtxExt = ObjectField(env, self, "ctx", FIELD_CTX_EXT);
-  ContextExt *ctx = getHandle<ContextExt>(env, jCtxExt, nativeContext);
-  return filterUastIterExt(ctx, jCtxExt, jquery, env);
+  if (!jquery) {
+    ThrowByName(env, CLS_RE, "query is null");
+    return 0;
+  }
+
+  const char *q = env->GetStringUTFChars(jquery, 0);
+  if (!q) return 0;  // OutOfMemoryError is pending
+  PreparedQuery *query = new PreparedQuery(q);
+  env->ReleaseStringUTFChars(jquery, q);
+
+  return reinterpret_cast<jlong>(query);
+}
+
+JNIEXPORT void JNICALL
+Java_org_bblfsh_client_v2_PreparedQuery_nativeDispose(JNIEnv *env,
+                                                      jobject self) {
+  PreparedQuery *p = getHandle<PreparedQuery>(env, self, FID_QUERY_NATIVE);
+  if (p) {
+    delete p;
+    setHandle<PreparedQuery>(env, self, 0, FID_QUERY_NATIVE);
+  }
 }
 
+// ==========================================
+//              v2.NativeCleaner
+// ==========================================
+
+// Kinds of the native objects freed by NativeCleaner.
+// Must be kept in sync with NativeCleaner on the Scala side.
+enum NativeKind {
+  NATIVE_CTX_EXT = 0,
+  NATIVE_CTX = 1,
+  NATIVE_LAZY_CTX = 2,
+  NATIVE_QUERY = 3,
+  NATIVE_ITER_EXT = 4,
+  NATIVE_ITER = 5,
+};
+
+// Frees a native object, whose JVM owner is unreachable and was not closed.
+JNIEXPORT void JNICALL Java_org_bblfsh_client_v2_NativeCleaner_00024_free(
+    JNIEnv *env, jobject self, jint kind, jlong ptr) {
+  if (!ptr) return;
+
+  switch (kind) {
+    case NATIVE_CTX_EXT:
+      reinterpret_cast<ContextExt *>(ptr)->Release();
+      break;
+    case NATIVE_CTX:
+      reinterpret_cast<Context *>(ptr)->Release();
+      break;
+    case NATIVE_LAZY_CTX:
+      delete reinterpret_cast<LazyContext *>(ptr);
+      break;
+    case NATIVE_QUERY:
+      delete reinterpret_cast<PreparedQuery *>(ptr);
+      break;
+    case NATIVE_ITER_EXT:
+      delete reinterpret_cast<IterExt *>(ptr);
+      break;
+    case NATIVE_ITER:
+      delete reinterpret_cast<Iter *>(ptr);
+      break;
+  }
+}
 
 // ==========================================
 //                Tree Orders
@@ -920,7 +2216,7 @@ JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_NodeExt_filter(
 // Exposes tree orders from the libuast to Scala
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_libuast_Libuast_getTreeOrders(JNIEnv *env,
                                                                                   jobject self) {
-    jobject jObj = NewJavaObject(env, CLS_TO, "(IIIIII)V",
+    jobject jObj = NewJavaObject(env, INIT_TO,
                                  ANY_ORDER,
                                  PRE_ORDER,
                                  POST_ORDER,
@@ -935,7 +2231,7 @@ JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_libuast_Libuast_getTreeOrder
 // ==========================================
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_libuast_Libuast_getUastFormats(JNIEnv *env,
                                                                                    jobject self) {
-    jobject jObj = NewJavaObject(env, CLS_ENCS, "(II)V",
+    jobject jObj = NewJavaObject(env, INIT_ENCS,
                                  UAST_BINARY,
                                  UAST_YAML);
     return jObj;
@@ -950,5 +2246,25 @@ JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void *reserved) {
   }
   jvm = vm;
 
+  if (!createThreadEnvKey()) {
+    return JNI_ERR;
+  }
+
+  if (!cacheJNIRefs(env)) {
+    releaseJNIRefs(env);
+    return JNI_ERR;
+  }
+
   return JNI_VERSION_1_8;
 }
+
+JNIEXPORT void JNI_OnUnload(JavaVM *vm, void *reserved) {
+  JNIEnv *env;
+  if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_8) != JNI_OK) {
+    return;
+  }
+  contextPool.Clear();
+  decodePool().Stop();
+  releaseJNIRefs(env);
+  deleteThreadEnvKey();
+}
@@ -15,6 +15,22 @@ extern "C" {
 JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_libuast_Libuast_decode
   (JNIEnv *, jobject, jobject, jint);
 
+/*
+ * Class:     org_bblfsh_client_v2_libuast_Libuast
+ * Method:    decodeAll
+ * Signature: ([Ljava/nio/ByteBuffer;[III)[Lorg/bblfsh/client/v2/ContextExt;
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_bblfsh_client_v2_libuast_Libuast_decodeAll
+  (JNIEnv *, jobject, jobjectArray, jintArray, jint, jint);
+
+/*
+ * Class:     org_bblfsh_client_v2_libuast_Libuast
+ * Method:    decodeBytes
+ * Signature: ([BIII)Lorg/bblfsh/client/v2/ContextExt;
+ */
+JNIEXPORT jobject JNICALL Java_org_bblfsh_client_v2_libuast_Libuast_decodeBytes
+  (JNIEnv *, jobject, jbyteArray, jint, jint, jint);
+
 /*
  * Class:     org_bblfsh_client_v2_libuast_Libuast
  * Method:    getTreeOrders
@@ -2,12 +2,14 @@ package org.bblfsh.client.v2
 
 import java.nio.ByteBuffer
 
-import com.google.protobuf.ByteString
+import com.google.protobuf.{ByteOutput, ByteString, UnsafeByteOperations}
 import gopkg.in.bblfsh.sdk.v2.protocol.driver._
 import io.grpc.ManagedChannelBuilder
 import java.util.concurrent.TimeUnit
 import org.bblfsh.client.v2.libuast.Libuast
 
+import scala.collection.mutable
+
 
 class BblfshClient(host: String, port: Int, maxMsgSize: Int) {
   // 1 minute default timeout
@@ -138,49 +140,183 @@ object BblfshClient {
 
   /**
     * Decodes bytes from wired format of bblfsh protocol.v2.
-    * Requires a buffer in Direct mode, and the format
-    * to decode from
+    * Requires a buffer either in Direct mode or backed by an accessible
+    * array, and the format to decode from. The bytes from the start of the
+    * buffer up to its limit are decoded.
+    *
+    * Safe to call concurrently from multiple threads.
     *
     * Since v2.
     */
-  def decode(buf: ByteBuffer, fmt: UastFormat): ContextExt = Libuast.synchronized {
-    if (!buf.isDirect()) {
-      throw new RuntimeException("Only directly-allocated buffer decoding is supported.")
+  def decode(buf: ByteBuffer, fmt: UastFormat): ContextExt = {
+    if (buf.isDirect()) {
+      libuast.decode(directView(buf), fmt)
+    } else if (buf.hasArray()) {
+      // the same as directView, only the bytes up to the limit are meaningful
+      libuast.decodeBytes(buf.array(), buf.arrayOffset(), buf.limit(), fmt)
+    } else {
+      throw new RuntimeException("Only direct or array-backed buffer decoding is supported.")
     }
-    libuast.decode(buf, fmt)
   }
 
   /**
     * Decodes bytes from wired binary format of bblfsh protocol.v2.
-    * Requires a buffer in Direct mode
+    * Requires a buffer either in Direct mode or backed by an accessible array
     *
     * Since v2.
     */
-  def decode(buf: ByteBuffer): ContextExt = Libuast.synchronized {
+  def decode(buf: ByteBuffer): ContextExt = {
     decode(buf, UastBinary)
   }
 
+  /** Views a direct buffer up to its limit, as the native side reads its whole capacity */
+  private def directView(buf: ByteBuffer): ByteBuffer = {
+    if (buf.limit() < buf.capacity()) {
+      // e.g. a pooled buffer, only the bytes up to the limit are meaningful
+      val whole = buf.duplicate()
+      whole.position(0)
+      whole.slice()
+    } else {
+      buf
+    }
+  }
+
+  /**
+    * Decodes many buffers from wired format of bblfsh protocol.v2 at once.
+    *
+    * Buffers are decoded concurrently by up to the given number of native
+    * threads, in a single JNI call. The threads are shared by all the calls
+    * and kept for the next ones. Direct buffers are read up to their limit,
+    * and the others are copied to pooled Direct buffers first.
+    *
+    * @return decoded contexts, in the same order as the buffers
+    */
+  def decodeAll(bufs: Seq[ByteBuffer], fmt: UastFormat, parallelism: Int): Seq[ContextExt] = {
+    require(parallelism > 0, s"parallelism must be positive, got $parallelism")
+
+    val pool = BufferPool.default
+    val copies = mutable.ArrayBuffer[ByteBuffer]()
+    try {
+      val direct = bufs.map { buf =>
+        if (buf.isDirect()) {
+          buf
+        } else {
+          val copy = pool.acquire(buf.limit())
+          copies += copy
+          val src = buf.duplicate()
+          src.position(0)
+          copy.put(src)
+          copy.flip()
+          copy
+        }
+      }.toArray
+      libuast.decodeAll(direct, direct.map(_.limit()), fmt, parallelism)
+    } finally {
+      copies.foreach(pool.release)
+    }
+  }
+
+  /** Decodes many buffers at once, using as many native threads as there are processors */
+  def decodeAll(bufs: Seq[ByteBuffer], fmt: UastFormat): Seq[ContextExt] = {
+    decodeAll(bufs, fmt, Runtime.getRuntime.availableProcessors())
+  }
+
+  /**
+    * Decodes a range of bytes from wired format of bblfsh protocol.v2.
+    *
+    * Bytes are copied natively to a reused per-thread buffer, with no copies
+    * on the JVM side.
+    */
+  def decode(bytes: Array[Byte], offset: Int, len: Int, fmt: UastFormat): ContextExt = {
+    libuast.decodeBytes(bytes, offset, len, fmt)
+  }
+
+  /** Decodes all the bytes from wired format of bblfsh protocol.v2 */
+  def decode(bytes: Array[Byte], fmt: UastFormat): ContextExt = {
+    decode(bytes, 0, bytes.length, fmt)
+  }
+
+  /**
+    * Captures the array backing a ByteString, without copying it.
+    *
+    * Only a ByteString that is backed by a single array is captured,
+    * otherwise the array stays null.
+    */
+  private class BackingArray extends ByteOutput {
+    var array: Array[Byte] = null
+    var offset = 0
+    var length = 0
+    private var chunks = 0
+
+    private def capture(value: Array[Byte], offset: Int, length: Int): Unit = {
+      chunks += 1
+      if (chunks == 1) {
+        this.array = value
+        this.offset = offset
+        this.length = length
+      } else {
+        this.array = null
+      }
+    }
+
+    override def write(value: Byte): Unit = {
+      chunks += 1
+      array = null
+    }
+    override def write(value: Array[Byte], offset: Int, length: Int): Unit = {
+      capture(value, offset, length)
+    }
+    override def writeLazy(value: Array[Byte], offset: Int, length: Int): Unit = {
+      capture(value, offset, length)
+    }
+    override def write(value: ByteBuffer): Unit = {
+      if (value.hasArray()) {
+        capture(value.array(), value.arrayOffset() + value.position(), value.remaining())
+      } else {
+        write(0: Byte)
+      }
+    }
+    override def writeLazy(value: ByteBuffer): Unit = {
+      write(value)
+    }
+  }
+
+  /**
+    * Runs f over a context, e.g. ContextExt or an iterator, and closes it
+    * right after, so its native memory is freed without waiting for the GC.
+    */
+  def withContext[C <: AutoCloseable, T](ctx: C)(f: C => T): T = {
+    try {
+      f(ctx)
+    } finally {
+      ctx.close()
+    }
+  }
+
   /** Enables API: resp.uast.decode() */
   implicit class UastMethods(val buf: ByteString) {
     /**
       * Decodes bytes from wire format of bblfsh protocol.v2.
       *
-      * Always copies memory to a new buffer in Direct mode,
-      * to be able to pass it to JNI.
+      * Decodes from the array backing the ByteString, if there is one.
+      * Otherwise copies the bytes to a pooled Direct buffer.
       */
     def decode(fmt: UastFormat): ContextExt = {
-      val bufDirectCopy = ByteBuffer.allocateDirect(buf.size)
-      buf.copyTo(bufDirectCopy)
-      val result = BblfshClient.decode(bufDirectCopy, fmt)
-      // Sometimes the direct buffer can take a lot to deallocate,
-      // causing Out of Memory, because it is not allocated in
-      // in the JVM heap and will only be deallocated them when
-      // JVM does not have more space in its heap
-      // This line alleviates the problem
-      // Problem can be tested if we remove it and do a
-      // loop decoding a file
-      System.gc()
-      result
+      val backing = new BackingArray
+      UnsafeByteOperations.unsafeWriteTo(buf, backing)
+      if (backing.array != null) {
+        BblfshClient.decode(backing.array, backing.offset, backing.length, fmt)
+      } else {
+        val pool = BufferPool.default
+        val bufDirectCopy = pool.acquire(buf.size)
+        try {
+          buf.copyTo(bufDirectCopy)
+          bufDirectCopy.flip()
+          BblfshClient.decode(bufDirectCopy, fmt)
+        } finally {
+          pool.release(bufDirectCopy)
+        }
+      }
     }
 
     /**
@@ -189,16 +325,18 @@ object BblfshClient {
     def decode(): ContextExt = {
       decode(UastBinary)
     }
+
+    /** Decodes in binary format and closes the context after using it */
+    def withContext[T](f: ContextExt => T): T = {
+      BblfshClient.withContext(decode())(f)
+    }
   }
 
   /** Enables API: resp.get() */
   implicit class ResponseMethods(val resp: ParseResponse) {
     /** Gets the root decoding the tree in binary format */
     def get(fmt: UastFormat): JNode = {
-      val ctx = resp.uast.decode(fmt)
-      val node = ctx.root().load()
-      ctx.dispose()
-      node
+      BblfshClient.withContext(resp.uast.decode(fmt))(_.root().load())
     }
 
     /** Gets the root node decoding the tree in binary format */
@@ -211,6 +349,8 @@ object BblfshClient {
   implicit class BblfshClientMethods(val client: BblfshClient) {
     def filter(node: NodeExt, query: String) = BblfshClient.filter(node, query)
     def filter(node: JNode, query: String) = BblfshClient.filter(node, query)
+    def filter(node: NodeExt, query: PreparedQuery) = BblfshClient.filter(node, query)
+    def filter(node: JNode, query: PreparedQuery) = BblfshClient.filter(node, query)
     def iterator(node: NodeExt, treeOrder: TreeOrder) = BblfshClient.iterator(node, treeOrder)
     def iterator(node: JNode, treeOrder: TreeOrder) = BblfshClient.iterator(node, treeOrder)
   }
@@ -226,12 +366,22 @@ object BblfshClient {
   }
 
   /** Factory method for iterator over an native node, filtered by XPath query */
-  def filter(node: NodeExt, query: String):  Libuast.UastIterExt = Libuast.synchronized {
+  def filter(node: NodeExt, query: String):  Libuast.UastIterExt = {
     node.filter(query)
   }
 
   /** Factory method for iterator over an managed node, filtered by XPath query */
-  def filter(node: JNode, query: String):  Libuast.UastIter = Libuast.synchronized {
+  def filter(node: JNode, query: String):  Libuast.UastIter = {
+    filter(node, PreparedQuery.cached(query))
+  }
+
+  /** Factory method for iterator over an native node, filtered by a prepared XPath query */
+  def filter(node: NodeExt, query: PreparedQuery):  Libuast.UastIterExt = {
+    node.filter(query)
+  }
+
+  /** Factory method for iterator over an managed node, filtered by a prepared XPath query */
+  def filter(node: JNode, query: PreparedQuery):  Libuast.UastIter = {
     val ctx = Context()
     ctx.filter(query, node)
     // do not dispose the context, iterator steals it
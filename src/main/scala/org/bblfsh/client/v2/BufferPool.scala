@@ -0,0 +1,100 @@
+package org.bblfsh.client.v2
+
+import java.nio.{ByteBuffer, ByteOrder}
+import java.util.ArrayDeque
+
+/**
+  * Pool of reusable Direct buffers, grouped in power-of-two size classes.
+  *
+  * Released buffers are kept for reuse up to maxRetainedBytes in total, so the
+  * amount of direct memory stays bounded instead of depending on when the GC
+  * frees it. A buffer must not be used after it is released.
+  *
+  * @param maxRetainedBytes max total capacity of the released buffers kept for reuse
+  */
+class BufferPool(val maxRetainedBytes: Long = BufferPool.DefaultMaxRetainedBytes) {
+  import BufferPool._
+
+  private val free = Array.fill(NumClasses)(new ArrayDeque[ByteBuffer]())
+  private var retainedBytes = 0L
+
+  /**
+    * Returns a Direct buffer of at least the given size.
+    *
+    * Buffer position is 0, its limit is the given size and its byte order is
+    * big-endian, whatever it was when released, while the capacity may be
+    * larger. Called from JNI.
+    */
+  def acquire(size: Int): ByteBuffer = {
+    require(size >= 0, s"negative buffer size $size")
+
+    val cls = sizeClass(size)
+    var buf: ByteBuffer = null
+    if (cls < NumClasses) synchronized {
+      buf = free(cls).pollFirst()
+      if (buf != null) {
+        retainedBytes -= buf.capacity()
+      }
+    }
+    if (buf == null) {
+      buf = ByteBuffer.allocateDirect(if (cls < NumClasses) classSize(cls) else size)
+    }
+
+    buf.clear()
+    buf.order(ByteOrder.BIG_ENDIAN)
+    buf.limit(size)
+    buf
+  }
+
+  /** Returns the buffer to the pool, if it fits the size classes and the retention limit */
+  def release(buf: ByteBuffer): Unit = {
+    if (buf == null || !buf.isDirect() || buf.isReadOnly()) {
+      return
+    }
+
+    val capacity = buf.capacity()
+    val cls = sizeClass(capacity)
+    if (cls >= NumClasses || classSize(cls) != capacity) {
+      return
+    }
+
+    synchronized {
+      if (retainedBytes + capacity <= maxRetainedBytes) {
+        free(cls).addFirst(buf)
+        retainedBytes += capacity
+      }
+    }
+  }
+
+  /** Total capacity of the released buffers kept for reuse */
+  def retained: Long = synchronized {
+    retainedBytes
+  }
+}
+
+object BufferPool {
+  /** Capacity of the smallest size class */
+  final val MinClassSize = 4 * 1024
+  /** Number of size classes, the largest one is 64 MiB */
+  final val NumClasses = 15
+  final val DefaultMaxRetainedBytes = 64L * 1024 * 1024
+
+  /** Pool used by default for decoding */
+  val default = new BufferPool()
+
+  /** Allocates buffers of exactly the requested capacity and never reuses them */
+  object Unpooled extends BufferPool(0) {
+    override def acquire(size: Int): ByteBuffer = ByteBuffer.allocateDirect(size)
+    override def release(buf: ByteBuffer): Unit = {}
+  }
+
+  private def sizeClass(size: Int): Int = {
+    if (size <= MinClassSize) {
+      0
+    } else {
+      32 - Integer.numberOfLeadingZeros(size - 1) - Integer.numberOfTrailingZeros(MinClassSize)
+    }
+  }
+
+  private def classSize(cls: Int): Int = MinClassSize << cls
+}
@@ -0,0 +1,79 @@
+package org.bblfsh.client.v2
+
+import java.io.OutputStream
+import java.nio.ByteBuffer
+import java.nio.channels.{Channels, WritableByteChannel}
+
+/**
+  * Destination of an encoded UAST, that is streamed to it in chunks.
+  *
+  * The native side copies each chunk to the same Direct chunk buffer and
+  * calls flush(), so the JVM never holds more than one chunk of the output.
+  *
+  * @param chunkSize capacity of the chunk buffer
+  * @param pool pool the chunk buffer is acquired from, and released to by close()
+  */
+abstract class ChunkSink(val chunkSize: Int = ChunkSink.DefaultChunkSize,
+                         pool: BufferPool = BufferPool.Unpooled) extends AutoCloseable {
+  require(chunkSize > 0, s"chunk size must be positive, got $chunkSize")
+
+  private var pooled: ByteBuffer = pool.acquire(chunkSize)
+
+  /** Reused for all the chunks, read from JNI. Exactly chunkSize bytes */
+  private[v2] val chunk: ByteBuffer = pooled.slice()
+
+  /** Consumes the next chunk, that is only valid until the call returns */
+  protected def write(chunk: ByteBuffer): Unit
+
+  /** Called from JNI after the first len bytes of the chunk buffer are filled */
+  private[v2] def flush(len: Int): Unit = {
+    chunk.clear()
+    chunk.limit(len)
+    write(chunk)
+  }
+
+  /** Returns the chunk buffer to its pool. Idempotent, the sink must not be used afterwards */
+  override def close(): Unit = {
+    if (pooled != null) {
+      pool.release(pooled)
+      pooled = null
+    }
+  }
+}
+
+object ChunkSink {
+  final val DefaultChunkSize = 64 * 1024
+
+  /**
+    * Writes chunks to a channel, blocking until each one is written fully.
+    * The chunk buffer comes from BufferPool.default, close() returns it.
+    */
+  def apply(out: WritableByteChannel, chunkSize: Int): ChunkSink = new ChunkSink(chunkSize, BufferPool.default) {
+    override protected def write(chunk: ByteBuffer): Unit = {
+      while (chunk.hasRemaining()) {
+        out.write(chunk)
+      }
+    }
+  }
+
+  def apply(out: WritableByteChannel): ChunkSink = apply(out, DefaultChunkSize)
+
+  /** Writes chunks to a stream. The stream is not flushed nor closed */
+  def apply(out: OutputStream, chunkSize: Int): ChunkSink = apply(Channels.newChannel(out), chunkSize)
+
+  def apply(out: OutputStream): ChunkSink = apply(out, DefaultChunkSize)
+
+  /** Streams to a sink over the channel, that is closed once f returns */
+  private[v2] def streamTo(out: WritableByteChannel)(f: ChunkSink => Unit): Unit = {
+    val sink = apply(out)
+    try {
+      f(sink)
+    } finally {
+      sink.close()
+    }
+  }
+
+  private[v2] def streamTo(out: OutputStream)(f: ChunkSink => Unit): Unit = {
+    streamTo(Channels.newChannel(out))(f)
+  }
+}
@@ -1,6 +1,8 @@
 package org.bblfsh.client.v2
 
+import java.io.OutputStream
 import java.nio.ByteBuffer
+import java.nio.channels.WritableByteChannel
 
 import org.bblfsh.client.v2.libuast.Libuast.{UastIter, UastIterExt}
 
@@ -8,52 +10,268 @@ import org.bblfsh.client.v2.libuast.Libuast.{UastIter, UastIterExt}
   * Represents Go-side constructed tree, result of Libuast.decode()
   *
   * This is equivalent of pyuast.ContextExt API
+  *
+  * Native memory is freed by close(), or once the context is unreachable.
+  * Iterators over the context keep its native tree alive until they are closed.
+  *
+  * Only created by the native side, that owns the pointer.
+  *
+  * @param nativeContext pointer to the native context, zeroed natively once it is freed
   */
-case class ContextExt(nativeContext: Long) {
-    import BblfshClient.{UastFormat, UastBinary}
+class ContextExt private[v2](@volatile private[v2] var nativeContext: Long) extends AutoCloseable {
+    import BblfshClient.{UastFormat, UastBinary, TreeOrder}
+
+    private val cleanable = NativeCleaner.register(this, NativeCleaner.ContextExtKind, nativeContext)
 
     // @native def load(): JNode // TODO(bzz): clarify when it's needed VS just .root().load()
     @native def root(): NodeExt
-    @native def filter(query: String): UastIterExt
-    @native def nativeEncode(n: NodeExt, fmt: Int): ByteBuffer
+    def filter(query: String): UastIterExt = filter(PreparedQuery.cached(query))
+    @native def filter(query: PreparedQuery): UastIterExt
+
+    /** Returns handles of the nodes matching the query, without allocating a NodeExt per node */
+    def filterHandles(query: String): Array[Long] = filterHandles(PreparedQuery.cached(query))
+    @native def filterHandles(query: PreparedQuery): Array[Long]
+
+    /**
+      * Runs all the queries in a single call, without allocating a NodeExt per node.
+      *
+      * Each query is still a separate pass over the tree, this only saves the
+      * JNI calls per query.
+      *
+      * @return handles of the matching nodes, for each query in the same order
+      */
+    def filterMany(queries: Seq[PreparedQuery]): Array[Array[Long]] = {
+      nativeFilterMany(queries.toArray)
+    }
+    def filterMany(queries: Seq[String])(implicit d: DummyImplicit): Array[Array[Long]] = {
+      filterMany(queries.map(PreparedQuery.cached))
+    }
+    @native def nativeFilterMany(queries: Array[PreparedQuery]): Array[Array[Long]]
+
+    /** Number of the nodes matching the query, counted natively */
+    def count(query: String): Long = count(PreparedQuery.cached(query))
+    @native def count(query: PreparedQuery): Long
+    /** True if any node matches the query, stops at the first match */
+    def exists(query: String): Boolean = exists(PreparedQuery.cached(query))
+    @native def exists(query: PreparedQuery): Boolean
+    /**
+      * Counts the values of the given field, e.g. "@type" or "@role", in all the nodes.
+      * Arrays of strings, like "@role", count each of their elements.
+      */
+    def countBy(field: String): Map[String, Long] = ContextExt.toCounts(nativeCountBy(field))
+    @native def nativeCountBy(field: String): Array[AnyRef]
+    /**
+      * Copies the whole tree to Direct buffers in a columnar layout, in a single
+      * native traversal. See UastColumns.
+      */
+    def toColumns(): UastColumns = toColumns(BufferPool.Unpooled)
+    /** Copies the tree to columns acquired from the pool, that can be released back to it */
+    def toColumns(pool: BufferPool): UastColumns = {
+      new UastColumns(nativeToColumns(pool).map(_.asInstanceOf[ByteBuffer]))
+    }
+    @native def nativeToColumns(pool: BufferPool): Array[AnyRef]
+    @native def nativeIterateHandles(order: Int): Array[Long]
+    /** Returns handles of all the nodes in the given order, without allocating a NodeExt per node */
+    def iterateHandles(order: TreeOrder): Array[Long] = {
+      nativeIterateHandles(order)
+    }
+    /** Wraps a handle returned by filterHandles or iterateHandles */
+    def node(handle: Long): NodeExt = NodeExt(this, handle)
+
+    @native def nativeEncode(n: NodeExt, fmt: Int, pool: BufferPool): ByteBuffer
     def encode(n: NodeExt, fmt: UastFormat): ByteBuffer = {
-      nativeEncode(n, fmt)
+      encode(n, fmt, BufferPool.Unpooled)
+    }
+    /** Encodes to a buffer acquired from the pool, that can be released back to it */
+    def encode(n: NodeExt, fmt: UastFormat, pool: BufferPool): ByteBuffer = {
+      nativeEncode(n, fmt, pool)
     }
     // encode using binary format
     def encode(n: NodeExt): ByteBuffer = {
       encode(n, UastBinary)
     }
-    @native def dispose()
-    override def finalize(): Unit = {
-        this.dispose()
+    /**
+      * Encodes and streams the result to the sink in chunks, so the encoded
+      * tree is never copied to the JVM as a whole.
+      */
+    def encodeTo(n: NodeExt, fmt: UastFormat, sink: ChunkSink): Unit = {
+      nativeEncodeTo(n, fmt, sink)
+    }
+    def encodeTo(n: NodeExt, fmt: UastFormat, out: WritableByteChannel): Unit = {
+      ChunkSink.streamTo(out)(encodeTo(n, fmt, _))
+    }
+    def encodeTo(n: NodeExt, fmt: UastFormat, out: OutputStream): Unit = {
+      ChunkSink.streamTo(out)(encodeTo(n, fmt, _))
+    }
+    @native def nativeEncodeTo(n: NodeExt, fmt: Int, sink: ChunkSink): Unit
+
+    /**
+      * Frees the native memory of the context. Idempotent.
+      * Native calls running on other threads keep it alive until they return,
+      * later calls throw.
+      */
+    override def close(): Unit = synchronized {
+      if (cleanable.cancel()) {
+        nativeDispose()
+      }
+    }
+    def dispose(): Unit = close()
+    @native def nativeDispose()
+}
+
+object ContextExt {
+    /** Takes ownership of a native pointer that no other context owns */
+    @deprecated("ContextExt is no longer a case class, contexts only come from decode()")
+    def apply(nativeContext: Long): ContextExt = new ContextExt(nativeContext)
+    @deprecated("ContextExt is no longer a case class")
+    def unapply(ctx: ContextExt): Option[Long] = Some(ctx.nativeContext)
+
+    /** Reads the result of nativeCountBy: an array of values and an array of their counts */
+    private[v2] def toCounts(res: Array[AnyRef]): Map[String, Long] = {
+      val keys = res(0).asInstanceOf[Array[String]]
+      val counts = res(1).asInstanceOf[Array[Long]]
+      keys.zip(counts).toMap
+    }
+}
+
+/**
+  * Represents a view of a Go-side tree, result of NodeExt.view()
+  *
+  * The tree is copied natively on the first expansion, and its nodes are
+  * copied to the JVM side by JLazy on demand. Until the first expansion the
+  * view keeps the native tree of its ContextExt alive.
+  *
+  * Only created by the native side, that owns the pointer.
+  *
+  * @param nativeContext pointer to the native context, zeroed natively once it is freed
+  */
+class LazyContext private[v2](@volatile private[v2] var nativeContext: Long) extends AutoCloseable {
+    private val cleanable = NativeCleaner.register(this, NativeCleaner.LazyContextKind, nativeContext)
+
+    // only takes handles that this context wrote as references, checked natively
+    @native private[v2] def expand(node: Long): Array[Byte]
+
+    /** Frees the native copy of the tree. Idempotent */
+    override def close(): Unit = synchronized {
+      if (cleanable.cancel()) {
+        nativeDispose()
+      }
     }
+    def dispose(): Unit = close()
+    @native def nativeDispose()
+}
+
+object LazyContext {
+    /** Takes ownership of a native pointer that no other context owns */
+    @deprecated("LazyContext is no longer a case class, views only come from NodeExt.view()")
+    def apply(nativeContext: Long): LazyContext = new LazyContext(nativeContext)
+    @deprecated("LazyContext is no longer a case class")
+    def unapply(ctx: LazyContext): Option[Long] = Some(ctx.nativeContext)
 }
 
 /**
   * Represents JVM-side constructed tree
   *
   * This is equivalent of pyuast.Context API
+  *
+  * Created by Context(), that takes the native context from a shared pool.
+  *
+  * @param nativeContext pointer to the native context, zeroed natively once it is freed
   */
-case class Context(nativeContext: Long) {
+class Context private[v2](@volatile private[v2] var nativeContext: Long) extends AutoCloseable {
     import BblfshClient.{UastFormat, UastBinary}
 
+    private val cleanable = NativeCleaner.register(this, NativeCleaner.ContextKind, nativeContext)
+
     @native def root(): JNode
-    @native def filter(query: String, node: JNode): UastIter
-    @native def nativeEncode(n: JNode, fmt: Int): ByteBuffer
+    def filter(query: String, node: JNode): UastIter = filter(PreparedQuery.cached(query), node)
+    @native def filter(query: PreparedQuery, node: JNode): UastIter
     def encode(n: JNode, fmt: UastFormat): ByteBuffer = {
-      nativeEncode(n, fmt)
+      Context.encode(n, fmt)
+    }
+    /** Encodes to a buffer acquired from the pool, that can be released back to it */
+    def encode(n: JNode, fmt: UastFormat, pool: BufferPool): ByteBuffer = {
+      Context.encode(n, fmt, pool)
     }
     // encode using binary format
     def encode(n: JNode): ByteBuffer = {
       encode(n, UastBinary)
     }
-    @native def dispose()
-    override def finalize(): Unit = {
-      this.dispose()
+    /** Encodes and streams the result to the sink in chunks */
+    def encodeTo(n: JNode, fmt: UastFormat, sink: ChunkSink): Unit = {
+      Context.encodeTo(n, fmt, sink)
+    }
+    def encodeTo(n: JNode, fmt: UastFormat, out: WritableByteChannel): Unit = {
+      ChunkSink.streamTo(out)(Context.encodeTo(n, fmt, _))
+    }
+    def encodeTo(n: JNode, fmt: UastFormat, out: OutputStream): Unit = {
+      ChunkSink.streamTo(out)(Context.encodeTo(n, fmt, _))
+    }
+
+    /**
+      * Frees the native memory of the context. Idempotent.
+      * Native calls running on other threads keep it alive until they return,
+      * later calls throw.
+      */
+    override def close(): Unit = synchronized {
+      if (cleanable.cancel()) {
+        nativeDispose()
+      }
     }
+    def dispose(): Unit = close()
+    @native def nativeDispose()
 }
 
 object Context {
+    import BblfshClient.UastFormat
+
+    /** Takes a native context from a shared pool, it goes back there once closed */
     @native def create(): Long
     def apply(): Context = new Context(create())
+
+    /** Takes ownership of a native pointer that no other context owns */
+    @deprecated("Context is no longer a case class, use Context() instead")
+    def apply(nativeContext: Long): Context = new Context(nativeContext)
+    @deprecated("Context is no longer a case class")
+    def unapply(ctx: Context): Option[Long] = Some(ctx.nativeContext)
+
+    /**
+      * Encodes a managed tree without any JNI calls per node.
+      *
+      * The tree is flattened to a pooled direct buffer on the JVM side first,
+      * so the native side can read it directly.
+      */
+    def encode(n: JNode, fmt: UastFormat): ByteBuffer = {
+      encode(n, fmt, BufferPool.Unpooled)
+    }
+
+    /** Encodes a managed tree to a buffer acquired from the pool */
+    def encode(n: JNode, fmt: UastFormat, pool: BufferPool): ByteBuffer = {
+      withFlat(n) { flat => encodeFlat(flat, flat.limit(), fmt, pool) }
+    }
+
+    /** Encodes a managed tree to a new array, without an intermediate buffer */
+    def encodeToArray(n: JNode, fmt: UastFormat): Array[Byte] = {
+      withFlat(n) { flat => encodeFlatToArray(flat, flat.limit(), fmt) }
+    }
+
+    /** Encodes a managed tree and streams the result to the sink in chunks */
+    def encodeTo(n: JNode, fmt: UastFormat, sink: ChunkSink): Unit = {
+      withFlat(n) { flat => encodeFlatTo(flat, flat.limit(), fmt, sink) }
+    }
+
+    private def withFlat[T](n: JNode)(f: ByteBuffer => T): T = {
+      val flat = JNode.writeFlat(n, BufferPool.default)
+      try {
+        f(flat)
+      } finally {
+        BufferPool.default.release(flat)
+      }
+    }
+
+    // the flat buffer is only parsed natively, within its own bounds; these
+    // are not an entry point for buffers that did not come from writeFlat
+    @native private[v2] def encodeFlat(buf: ByteBuffer, len: Int, fmt: Int, pool: BufferPool): ByteBuffer
+    @native private[v2] def encodeFlatToArray(buf: ByteBuffer, len: Int, fmt: Int): Array[Byte]
+    @native private[v2] def encodeFlatTo(buf: ByteBuffer, len: Int, fmt: Int, sink: ChunkSink): Unit
 }
@@ -0,0 +1,81 @@
+package org.bblfsh.client.v2
+
+import java.lang.ref.{PhantomReference, ReferenceQueue}
+import java.util.Collections
+import java.util.concurrent.ConcurrentHashMap
+import java.util.concurrent.atomic.AtomicBoolean
+
+import org.bblfsh.client.v2.libuast.Libuast
+
+/**
+  * Safety net that frees the native memory of objects that were not closed.
+  *
+  * Each owner of native memory registers itself together with a pointer to
+  * it. Once the owner becomes unreachable, the memory is freed by a daemon
+  * thread, with no finalizer. The same as java.lang.ref.Cleaner, that is not
+  * available on Java 8.
+  */
+private[v2] object NativeCleaner {
+  Libuast
+
+  // Kinds of the native objects, must be kept in sync with NativeKind in
+  // org_bblfsh_client_v2_libuast_Libuast.cc
+  final val ContextExtKind = 0
+  final val ContextKind = 1
+  final val LazyContextKind = 2
+  final val QueryKind = 3
+  final val IterExtKind = 4
+  final val IterKind = 5
+
+  /** Frees a native object of the given kind */
+  @native def free(kind: Int, ptr: Long): Unit
+
+  private val queue = new ReferenceQueue[AnyRef]()
+  // keeps registered references reachable until they are cleaned or cancelled
+  private val live = Collections.newSetFromMap(new ConcurrentHashMap[Cleanable, java.lang.Boolean]())
+
+  /** Registration of a single owner, that frees its native memory at most once */
+  final class Cleanable private[NativeCleaner](owner: AnyRef, kind: Int, ptr: Long)
+      extends PhantomReference[AnyRef](owner, queue) {
+    private val active = new AtomicBoolean(ptr != 0)
+
+    /**
+      * Unregisters the owner without freeing its memory, as it is freed by
+      * the owner itself. Returns false if it was already cleaned or cancelled.
+      */
+    def cancel(): Boolean = {
+      live.remove(this)
+      active.getAndSet(false)
+    }
+
+    private[NativeCleaner] def clean(): Unit = {
+      if (cancel()) {
+        free(kind, ptr)
+      }
+    }
+  }
+
+  /** Registers an owner of a native object of the given kind */
+  def register(owner: AnyRef, kind: Int, ptr: Long): Cleanable = {
+    val c = new Cleanable(owner, kind, ptr)
+    if (ptr != 0) {
+      live.add(c)
+    }
+    c
+  }
+
+  private val thread = new Thread("bblfsh-native-cleaner") {
+    override def run(): Unit = {
+      while (true) {
+        try {
+          queue.remove().asInstanceOf[Cleanable].clean()
+        } catch {
+          // there is no one to report a failed free to, keep freeing the rest
+          case _: Throwable =>
+        }
+      }
+    }
+  }
+  thread.setDaemon(true)
+  thread.start()
+}
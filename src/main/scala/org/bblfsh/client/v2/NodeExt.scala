@@ -1,7 +1,8 @@
 package org.bblfsh.client.v2
 
 import java.io.Serializable
-import java.nio.ByteBuffer
+import java.nio.{ByteBuffer, ByteOrder}
+import java.nio.charset.StandardCharsets
 
 import org.bblfsh.client.v2.libuast.Libuast.UastIterExt
 
@@ -16,8 +17,32 @@ import scala.collection.mutable
   * @param handle pointer to the native Node
   */
 case class NodeExt(ctx: ContextExt, handle: Long) {
-  @native def load(): JNode
-  @native def filter(query: String): UastIterExt
+  /** Copies the whole subtree of this node to the JVM side */
+  def load(): JNode = JNode.readFlat(nativeLoad())
+
+  /**
+    * Returns a view of the subtree of this node, that materializes nodes on
+    * the JVM side only when accessed.
+    *
+    * Libuast can only read the subtree as a whole, so it is copied natively
+    * on the first access to the view. See LazyContext.
+    */
+  def view(): JNode = new JLazy(nativeView(), JLazy.UnknownKind, 0)
+
+  @native def nativeLoad(): Array[Byte]
+  @native def nativeView(): LazyContext
+  def filter(query: String): UastIterExt = filter(PreparedQuery.cached(query))
+  @native def filter(query: PreparedQuery): UastIterExt
+
+  /** Number of the nodes under this node matching the query, counted natively */
+  def count(query: String): Long = count(PreparedQuery.cached(query))
+  @native def count(query: PreparedQuery): Long
+  /** True if any node under this node matches the query, stops at the first match */
+  def exists(query: String): Boolean = exists(PreparedQuery.cached(query))
+  @native def exists(query: PreparedQuery): Boolean
+  /** Counts the values of the given field, e.g. "@type", in all the nodes under this node */
+  def countBy(field: String): Map[String, Long] = ContextExt.toCounts(nativeCountBy(field))
+  @native def nativeCountBy(field: String): Array[AnyRef]
 }
 
 
@@ -30,12 +55,11 @@ case class NodeExt(ctx: ContextExt, handle: Long) {
 sealed abstract class JNode {
   import BblfshClient.{UastFormat, UastBinary}
 
+  /** Kind of this node, one of [[JNode.Kind]]. Read by JNI instead of type checks */
+  def kind: Int
+
   def toByteArray(fmt: UastFormat): Array[Byte] = {
-    val buf = toByteBuffer(fmt)
-    val arr = new Array[Byte](buf.capacity())
-    buf.get(arr)
-    buf.rewind()
-    arr
+    Context.encodeToArray(this, fmt)
   }
 
   /** Use binary UAST format */
@@ -44,10 +68,12 @@ sealed abstract class JNode {
   }
 
   def toByteBuffer(fmt: UastFormat): ByteBuffer = {
-    val ctx = Context()
-    val bb = ctx.encode(this, fmt)
-    ctx.dispose()
-    bb
+    Context.encode(this, fmt)
+  }
+
+  /** Encodes to a buffer acquired from the pool, that can be released back to it */
+  def toByteBuffer(fmt: UastFormat, pool: BufferPool): ByteBuffer = {
+    Context.encode(this, fmt, pool)
   }
 
   /** Use binary UAST format */
@@ -89,34 +115,213 @@ sealed abstract class JNode {
 object JNode {
   import BblfshClient.{UastFormat, UastBinary}
 
-  private def decodeFrom(bytes: ByteBuffer, fmt: UastFormat): JNode = {
-    val ctx = BblfshClient.decode(bytes, fmt)
+  /** Stable integer tags of the node kinds, must match the native side */
+  object Kind {
+    final val Null = 0
+    final val Object = 1
+    final val Array = 2
+    final val String = 3
+    final val Int = 4
+    final val Uint = 5
+    final val Float = 6
+    final val Bool = 7
+  }
+
+  /** Tag of a reference to an unexpanded native node in the flat layout */
+  private final val FlatRef = 8
+
+  /**
+    * Reads a tree in the flat layout produced by the native side in a single
+    * pass. The layout is documented in src/main/native/flat_uast.h
+    *
+    * @param bytes tree in the flat layout, or null
+    * @param lazyCtx context that resolves references to unexpanded nodes
+    * @return JNode of the tree root, or null
+    */
+  private[v2] def readFlat(bytes: Array[Byte], lazyCtx: LazyContext = null): JNode = {
+    if (bytes == null) {
+      return null
+    }
+
+    val buf = ByteBuffer.wrap(bytes).order(ByteOrder.nativeOrder())
+    val strings = new Array[String](buf.getInt())
+    var i = 0
+    while (i < strings.length) {
+      val len = buf.getInt()
+      strings(i) = new String(bytes, buf.position(), len, StandardCharsets.UTF_8)
+      buf.position(buf.position() + len)
+      i += 1
+    }
+    readFlatNode(buf, strings, lazyCtx)
+  }
+
+  /**
+    * Writes a tree in the flat layout expected by the native side, in a
+    * single pass. The layout is documented in src/main/native/flat_uast.h
+    *
+    * @param node root of the tree
+    * @param pool pool to acquire the result buffer from
+    * @return direct buffer with the tree in the flat layout, up to its limit
+    */
+  private[v2] def writeFlat(node: JNode, pool: BufferPool): ByteBuffer = {
+    val w = new FlatWriter
+    w.write(node)
+    w.result(pool)
+  }
+
+  /** Appends nodes in the flat layout, interning all the strings */
+  private class FlatWriter {
+    private var nodes = ByteBuffer.allocate(4096).order(ByteOrder.nativeOrder())
+    private val stringIds = mutable.HashMap[String, Int]()
+    private val strings = mutable.ArrayBuffer[Array[Byte]]()
+    private var stringsSize = 0
+
+    private def ensure(n: Int): Unit = {
+      if (nodes.remaining() < n) {
+        val grown = ByteBuffer.allocate(math.max(nodes.capacity() * 2, nodes.position() + n))
+          .order(ByteOrder.nativeOrder())
+        nodes.flip()
+        grown.put(nodes)
+        nodes = grown
+      }
+    }
+
+    private def intern(s: String): Int = {
+      stringIds.getOrElseUpdate(s, {
+        val bytes = s.getBytes(StandardCharsets.UTF_8)
+        strings += bytes
+        stringsSize += 4 + bytes.length
+        strings.size - 1
+      })
+    }
+
+    def write(node: JNode): Unit = node match {
+      case JObject(obj) =>
+        ensure(5)
+        nodes.put(Kind.Object.toByte).putInt(obj.size)
+        obj.foreach { case (k, v) =>
+          val id = intern(k)
+          ensure(4)
+          nodes.putInt(id)
+          write(v)
+        }
+      case JArray(arr) =>
+        ensure(5)
+        nodes.put(Kind.Array.toByte).putInt(arr.size)
+        arr.foreach(write)
+      case JString(str) =>
+        val id = intern(str)
+        ensure(5)
+        nodes.put(Kind.String.toByte).putInt(id)
+      case JInt(num) =>
+        ensure(9)
+        nodes.put(Kind.Int.toByte).putLong(num)
+      case u: JUint =>
+        ensure(9)
+        nodes.put(Kind.Uint.toByte).putLong(u.get())
+      case JFloat(num) =>
+        ensure(9)
+        nodes.put(Kind.Float.toByte).putDouble(num)
+      case JBool(value) =>
+        ensure(2)
+        nodes.put(Kind.Bool.toByte).put((if (value) 1 else 0).toByte)
+      case l: JLazy =>
+        write(l.node)
+      case _ =>
+        ensure(1)
+        nodes.put(Kind.Null.toByte)
+    }
+
+    /** Returns the string table followed by all the written nodes */
+    def result(pool: BufferPool): ByteBuffer = {
+      val out = pool.acquire(4 + stringsSize + nodes.position())
+        .order(ByteOrder.nativeOrder())
+      out.putInt(strings.size)
+      strings.foreach { bytes =>
+        out.putInt(bytes.length)
+        out.put(bytes)
+      }
+      nodes.flip()
+      out.put(nodes)
+      out.flip()
+      out
+    }
+  }
+
+  private def readFlatNode(buf: ByteBuffer, strings: Array[String],
+                           lazyCtx: LazyContext): JNode = {
+    buf.get().toInt match {
+      case Kind.Object =>
+        val size = buf.getInt()
+        val fields = new mutable.ArrayBuffer[JField](size)
+        var i = 0
+        while (i < size) {
+          val key = strings(buf.getInt())
+          fields += ((key, readFlatNode(buf, strings, lazyCtx)))
+          i += 1
+        }
+        new JObject(fields)
+      case Kind.Array =>
+        val size = buf.getInt()
+        val arr = new mutable.ArrayBuffer[JNode](size)
+        var i = 0
+        while (i < size) {
+          arr += readFlatNode(buf, strings, lazyCtx)
+          i += 1
+        }
+        new JArray(arr)
+      case Kind.String => JString(strings(buf.getInt()))
+      case Kind.Int => JInt(buf.getLong())
+      case Kind.Uint => JUint(buf.getLong())
+      case Kind.Float => JFloat(buf.getDouble())
+      case Kind.Bool => JBool(buf.get() != 0)
+      case FlatRef =>
+        if (lazyCtx == null) {
+          throw new RuntimeException("unexpected reference to a native node")
+        }
+        val kind = buf.get().toInt
+        new JLazy(lazyCtx, kind, buf.getLong())
+      case Kind.Null => JNull.Shared
+      case tag => throw new RuntimeException(s"unknown node kind $tag in the flat UAST")
+    }
+  }
+
+  private def loadAndDispose(ctx: ContextExt): JNode = {
     val node = ctx.root().load()
     ctx.dispose()
     node
   }
 
+  private def decodeFrom(bytes: ByteBuffer, fmt: UastFormat): JNode = {
+    loadAndDispose(BblfshClient.decode(bytes, fmt))
+  }
+
   /**
     * Decodes UAST from the given Buffer.
     *
-    * If the buffer is Direct, it will avoid extra memory allocation,
-    * otherwise it will copy the content to a new Direct buffer.
+    * If the buffer is Direct or backed by an accessible array, it will avoid
+    * extra memory allocation, otherwise it will copy the content to a pooled
+    * Direct buffer.
     *
     * @param original UAST encoded in wire format of protocol.v2
     * @return JNode of the UAST root
     */
   def parseFrom(original: ByteBuffer, fmt: UastFormat): JNode = {
-    val bufDirect = if (!original.isDirect) {
-      val bufDirectCopy = ByteBuffer.allocateDirect(original.capacity())
-      original.rewind()
-      bufDirectCopy.put(original)
-      original.rewind()
-      bufDirectCopy.flip()
-      bufDirectCopy
+    if (!original.isDirect && !original.hasArray) {
+      val pool = BufferPool.default
+      val bufDirectCopy = pool.acquire(original.capacity())
+      try {
+        original.rewind()
+        bufDirectCopy.put(original)
+        original.rewind()
+        bufDirectCopy.flip()
+        decodeFrom(bufDirectCopy, fmt)
+      } finally {
+        pool.release(bufDirectCopy)
+      }
     } else {
-      original
+      decodeFrom(original, fmt)
     }
-    decodeFrom(bufDirect, fmt)
   }
 
   /** Parse from a buffer using binary UAST format */
@@ -127,17 +332,13 @@ object JNode {
   /**
     * Decodes UAST from the given bytes.
     *
-    * It will copy memory into temporary Direct buffer,
-    * otherwise it will copy the content to a new Direct buffer.
+    * Bytes are read in place, without copying them to a Direct buffer.
     *
     * @param bytes UAST encoded in wire format of protocol.v2
     * @return JNode of the UAST root
     */
   def parseFrom(bytes: Array[Byte], fmt: UastFormat): JNode = {
-    val bufDirect = ByteBuffer.allocateDirect(bytes.size)
-    bufDirect.put(bytes)
-    bufDirect.flip()
-    decodeFrom(bufDirect, fmt)
+    loadAndDispose(BblfshClient.decode(bytes, fmt))
   }
 
   /** Parse from an array using binary UAST format */
@@ -146,18 +347,37 @@ object JNode {
   }
 }
 
-case object JNothing extends JNode // 'zero' value for JNode
-case class JNull() extends JNode
-case class JString(str: String) extends JNode
-case class JFloat(num: Double) extends JNode
+case object JNothing extends JNode { // 'zero' value for JNode
+  def kind: Int = JNode.Kind.Null
+}
+case class JNull() extends JNode {
+  def kind: Int = JNode.Kind.Null
+}
+object JNull {
+  /** Instance shared by all the decoded null values, as JNull is immutable */
+  private[v2] val Shared = new JNull()
+}
+case class JString(str: String) extends JNode {
+  def kind: Int = JNode.Kind.String
+}
+case class JFloat(num: Double) extends JNode {
+  def kind: Int = JNode.Kind.Float
+}
 case class JUint(num: Long) extends JNode {
+  def kind: Int = JNode.Kind.Uint
   def get(): Long = java.lang.Integer.toUnsignedLong(num.toInt)
 }
-case class JInt(num: Long) extends JNode
-case class JBool(value: Boolean) extends JNode
+case class JInt(num: Long) extends JNode {
+  def kind: Int = JNode.Kind.Int
+}
+case class JBool(value: Boolean) extends JNode {
+  def kind: Int = JNode.Kind.Bool
+}
 
 case class JObject(obj: mutable.Buffer[JField]) extends JNode {
   def this() = this(mutable.Buffer[JField]())
+  def this(size: Int) = this(new mutable.ArrayBuffer[JField](size))
+  def kind: Int = JNode.Kind.Object
   def filter(p: JField => Boolean) = obj.filter(p)
   def keys(): mutable.Buffer[String] = {
     obj.map{ case (key, value) => key }
@@ -169,6 +389,16 @@ case class JObject(obj: mutable.Buffer[JField]) extends JNode {
   def add(k: String, v: JNode) = {
     obj += ((k, v))
   }
+  /** Same as add, without a result to box. Called from JNI */
+  private[v2] def append(k: String, v: JNode): Unit = {
+    obj += ((k, v))
+  }
+
+  override def equals(other: Any): Boolean = other match {
+    case JObject(o) => obj == o
+    case l: JLazy => this == l.node
+    case _ => false
+  }
 }
 case object JObject {
   def apply[T <: (Product with Serializable with JNode)](ns: (String, T)*) = {
@@ -180,11 +410,59 @@ case object JObject {
 
 case class JArray(arr: mutable.Buffer[JNode]) extends JNode {
   def this(size: Int) = this(new mutable.ArrayBuffer[JNode](size))
+  def kind: Int = JNode.Kind.Array
   def filter(p: JNode => Boolean) = this.arr.filter(p)
   def add(n: JNode) = {
     arr += n
   }
+  /** Same as add, without a result to box. Called from JNI */
+  private[v2] def append(n: JNode): Unit = {
+    arr += n
+  }
+
+  override def equals(other: Any): Boolean = other match {
+    case JArray(a) => arr == a
+    case l: JLazy => this == l.node
+    case _ => false
+  }
 }
+/**
+  * Lazy view of an object or an array that was not copied to the JVM side yet.
+  *
+  * The node is expanded from its native context on the first access to its
+  * content and memoized, while its children stay lazy until they are accessed.
+  * It is equal to the expanded node, so equality and hashing expand it.
+  *
+  * @param ctx native context that owns the node
+  * @param knownKind kind of the node, or UnknownKind if it is only known once expanded
+  * @param handle pointer to the native node
+  */
+final class JLazy private[v2](private[v2] val ctx: LazyContext, knownKind: Int, handle: Long) extends JNode {
+  /** Expanded node */
+  lazy val node: JNode = JNode.readFlat(ctx.expand(handle), ctx)
+
+  def kind: Int = if (knownKind != JLazy.UnknownKind) knownKind else node.kind
+
+  override def children: Seq[JNode] = node.children
+  override def size: Int = node.size
+  override def keyAt(i: Int): String = node.keyAt(i)
+  override def valueAt(i: Int): JNode = node.valueAt(i)
+  override def apply(k: String): JNode = node(k)
+  override def toString: String = node.toString
+
+  override def equals(other: Any): Boolean = other match {
+    case l: JLazy => node == l.node
+    case n: JNode => node == n
+    case _ => false
+  }
+  override def hashCode: Int = node.hashCode
+}
+
+object JLazy {
+  /** Kind of a view whose root was not expanded yet */
+  final val UnknownKind = -1
+}
+
 case object JArray {
   /** Helper to construct literals in map-like notation */
   def apply[T <:  (Product with Serializable with JNode)](ns: T *)   = {
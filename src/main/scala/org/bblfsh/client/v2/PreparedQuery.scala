@@ -0,0 +1,88 @@
+package org.bblfsh.client.v2
+
+import java.util.concurrent.ConcurrentHashMap
+
+import org.bblfsh.client.v2.libuast.Libuast
+
+/**
+  * XPath query that is converted once and can be run against any number of
+  * contexts. Immutable, so it can be shared across threads.
+  *
+  * Accepted by all the filter methods instead of a query String. Libuast
+  * 3.4.2 has no API for compiled queries and compiles the query text on every
+  * filter, so this only saves passing and converting the String on each call.
+  *
+  * @param query XPath query text
+  * @param nativeQuery pointer to the native query, zeroed natively once it is freed
+  */
+final class PreparedQuery private(val query: String, @volatile private[v2] var nativeQuery: Long, shared: Boolean)
+    extends AutoCloseable {
+  private val cleanable = NativeCleaner.register(this, NativeCleaner.QueryKind, nativeQuery)
+
+  /**
+    * Frees the native query. Idempotent, and a no-op on the queries returned
+    * by [[PreparedQuery.cached]], that are freed once unreachable.
+    */
+  override def close(): Unit = synchronized {
+    if (!shared && cleanable.cancel()) {
+      nativeDispose()
+    }
+  }
+  def dispose(): Unit = close()
+  @native def nativeDispose()
+
+  override def toString: String = s"PreparedQuery($query)"
+}
+
+object PreparedQuery {
+  Libuast
+
+  /** Max number of queries kept by [[cached]] */
+  final val CacheSize = 512
+
+  @native def prepare(query: String): Long
+
+  def apply(query: String): PreparedQuery = new PreparedQuery(query, prepare(query), false)
+
+  private final class CacheEntry(val query: PreparedQuery) {
+    @volatile var lastUsed: Long = System.nanoTime()
+  }
+
+  // Lookups do not lock, only the least recently used entry is looked for
+  // when a new query overflows the cache. Evicted queries are not disposed,
+  // as they may still be in use, but freed once unreachable
+  private val cache = new ConcurrentHashMap[String, CacheEntry]()
+
+  /** Returns a query prepared from the given text, shared through an LRU cache */
+  def cached(query: String): PreparedQuery = {
+    val entry = cache.get(query)
+    if (entry != null) {
+      entry.lastUsed = System.nanoTime()
+      return entry.query
+    }
+
+    val added = new CacheEntry(new PreparedQuery(query, prepare(query), true))
+    val raced = cache.putIfAbsent(query, added)
+    if (raced != null) {
+      return raced.query
+    }
+    if (cache.size() > CacheSize) {
+      evictEldest()
+    }
+    added.query
+  }
+
+  private def evictEldest(): Unit = {
+    var eldest: java.util.Map.Entry[String, CacheEntry] = null
+    val it = cache.entrySet().iterator()
+    while (it.hasNext) {
+      val e = it.next()
+      if (eldest == null || e.getValue.lastUsed < eldest.getValue.lastUsed) {
+        eldest = e
+      }
+    }
+    if (eldest != null) {
+      cache.remove(eldest.getKey, eldest.getValue)
+    }
+  }
+}
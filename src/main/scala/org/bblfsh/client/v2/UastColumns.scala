@@ -0,0 +1,96 @@
+package org.bblfsh.client.v2
+
+import java.nio.{ByteBuffer, ByteOrder, IntBuffer}
+import java.nio.charset.StandardCharsets
+
+/**
+  * Columnar (struct-of-arrays) copy of a UAST, result of ContextExt.toColumns()
+  *
+  * There is one row per node in pre-order. Nodes under "@pos" are folded into
+  * the position columns of their owner. Absent values are -1 (positions,
+  * string ids and the parent of the root), and all strings are ids in a
+  * single deduplicated dictionary.
+  *
+  * Each column is a Direct buffer of int32 in native byte order, but for the
+  * UTF-8 string data. Roles and the dictionary are offsets plus values: the
+  * roles of row i are Roles(RoleOffsets(i) until RoleOffsets(i + 1)), and the
+  * same goes for the bytes of string i. This is a layout of its own, readers
+  * that expect validity bitmaps (like Arrow) have to convert the -1 values.
+  * A tree with a column larger than 2 GiB fails to convert.
+  * Column order must be kept in sync with ColumnId in flat_uast.h.
+  *
+  * @param buffers raw column buffers, indexed by the column ids below
+  */
+final class UastColumns private[v2](val buffers: Array[ByteBuffer]) {
+  import UastColumns._
+
+  buffers.foreach(_.order(ByteOrder.nativeOrder()))
+
+  /** Number of rows, i.e. UAST nodes */
+  val rows: Int = buffers(Parent).limit() / 4
+  /** Number of strings in the dictionary */
+  val strings: Int = buffers(StringOffsets).limit() / 4 - 1
+
+  /** Returns a given int32 column */
+  def column(id: Int): IntBuffer = buffers(id).duplicate().order(ByteOrder.nativeOrder()).asIntBuffer()
+
+  def parent: IntBuffer = column(Parent)
+  def depth: IntBuffer = column(Depth)
+  def typeId: IntBuffer = column(Type)
+  def tokenId: IntBuffer = column(Token)
+  def startOffset: IntBuffer = column(StartOffset)
+  def endOffset: IntBuffer = column(EndOffset)
+  def startLine: IntBuffer = column(StartLine)
+  def startCol: IntBuffer = column(StartCol)
+  def endLine: IntBuffer = column(EndLine)
+  def endCol: IntBuffer = column(EndCol)
+
+  /** Returns the dictionary ids of the roles of a given row */
+  def roleIds(row: Int): Array[Int] = {
+    val offsets = column(RoleOffsets)
+    val from = offsets.get(row)
+    val res = new Array[Int](offsets.get(row + 1) - from)
+    val ids = column(Roles)
+    ids.position(from)
+    ids.get(res)
+    res
+  }
+
+  /** Returns a string from the dictionary, or null for -1 */
+  def string(id: Int): String = {
+    if (id < 0) {
+      return null
+    }
+
+    val offsets = column(StringOffsets)
+    val from = offsets.get(id)
+    val bytes = new Array[Byte](offsets.get(id + 1) - from)
+    val data = buffers(StringData).duplicate()
+    data.position(from)
+    data.get(bytes)
+    new String(bytes, StandardCharsets.UTF_8)
+  }
+
+  /** Returns the column buffers to the pool they were acquired from */
+  def release(pool: BufferPool): Unit = {
+    buffers.foreach(pool.release)
+  }
+}
+
+object UastColumns {
+  final val Parent = 0
+  final val Depth = 1
+  final val Type = 2
+  final val Token = 3
+  final val StartOffset = 4
+  final val EndOffset = 5
+  final val StartLine = 6
+  final val StartCol = 7
+  final val EndLine = 8
+  final val EndCol = 9
+  final val RoleOffsets = 10
+  final val Roles = 11
+  final val StringOffsets = 12
+  final val StringData = 13
+  final val NumColumns = 14
+}
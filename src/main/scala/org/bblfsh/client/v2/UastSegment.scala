@@ -0,0 +1,270 @@
+package org.bblfsh.client.v2
+
+import java.io.{Closeable, IOException}
+import java.nio.ByteBuffer
+import java.nio.channels.FileChannel
+import java.nio.charset.StandardCharsets
+import java.nio.file.{Path, StandardOpenOption}
+
+import scala.collection.mutable
+
+/**
+  * Append-only segment file of many encoded UASTs, addressed by a key.
+  *
+  * Layout, all numbers are big-endian:
+  *
+  *   header    8 bytes magic, int64 length of the committed part of the file
+  *   payloads  encoded UASTs, back to back
+  *   index     for each entry: int32 key length, UTF-8 key, int64 offset, int32 length
+  *   trailer   int64 index offset, int32 number of entries, 8 bytes magic
+  *
+  * Each writer appends its payloads, a new index of all the entries and a new
+  * trailer after the committed part, and then commits them by updating the
+  * length in the header. The committed part is never overwritten, so a crash
+  * only loses the payloads of the writer that did not close, and anything
+  * after the committed length is ignored. A key appended again shadows the
+  * older payload, and old indexes are left in the file as dead space.
+  */
+object UastSegment {
+  final val HeaderMagic = "UASTSEG1".getBytes(StandardCharsets.US_ASCII)
+  final val HeaderSize = HeaderMagic.length + 8
+  final val TrailerMagic = "UASTIDX1".getBytes(StandardCharsets.US_ASCII)
+  final val TrailerSize = 8 + 4 + TrailerMagic.length
+  // key length, offset and length of an entry with an empty key
+  private final val MinEntrySize = 4 + 8 + 4
+
+  /** Location of a payload in a segment */
+  case class Entry(offset: Long, length: Int)
+
+  /** Creates a new segment, or opens an existing one to append to it */
+  def writer(path: Path): UastSegmentWriter = new UastSegmentWriter(path)
+
+  /** Opens an existing segment for reading, only its index is read */
+  def open(path: Path): UastSegmentReader = new UastSegmentReader(path)
+
+  /** Reads the header of an open segment, returns the committed length or zero if none */
+  private[v2] def readHeader(ch: FileChannel): Long = {
+    val size = ch.size()
+    if (size < HeaderSize) {
+      throw new IOException("not a UAST segment")
+    }
+
+    val header = ByteBuffer.allocate(HeaderSize)
+    readFully(ch, header, 0)
+    header.flip()
+    val magic = new Array[Byte](HeaderMagic.length)
+    header.get(magic)
+    if (!java.util.Arrays.equals(magic, HeaderMagic)) {
+      throw new IOException("not a UAST segment")
+    }
+
+    val committed = header.getLong()
+    if (committed != 0 && (committed < HeaderSize + TrailerSize || committed > size)) {
+      throw new IOException(s"corrupted UAST segment header, committed length $committed")
+    }
+    committed
+  }
+
+  /** Reads the committed index of an open segment, returns its entries */
+  private[v2] def readIndex(ch: FileChannel, committed: Long): mutable.LinkedHashMap[String, Entry] = {
+    if (committed == 0) {
+      throw new IOException("UAST segment was never closed")
+    }
+
+    val trailer = ByteBuffer.allocate(TrailerSize)
+    readFully(ch, trailer, committed - TrailerSize)
+    trailer.flip()
+    val indexOffset = trailer.getLong()
+    val count = trailer.getInt()
+    val magic = new Array[Byte](TrailerMagic.length)
+    trailer.get(magic)
+    if (!java.util.Arrays.equals(magic, TrailerMagic)) {
+      throw new IOException("corrupted UAST segment trailer")
+    }
+
+    def corrupted(what: String) = new IOException(s"corrupted UAST segment index at $indexOffset: $what")
+
+    val indexSize = committed - TrailerSize - indexOffset
+    if (indexOffset < HeaderSize || indexSize < 0 || indexSize > Int.MaxValue) {
+      throw corrupted("out of bounds")
+    }
+    if (count < 0 || count.toLong * MinEntrySize > indexSize) {
+      throw corrupted(s"$count entries do not fit in $indexSize bytes")
+    }
+
+    val buf = ch.map(FileChannel.MapMode.READ_ONLY, indexOffset, indexSize)
+    val index = mutable.LinkedHashMap[String, Entry]()
+    for (_ <- 0 until count) {
+      if (buf.remaining() < MinEntrySize) {
+        throw corrupted("truncated entry")
+      }
+      val keyLength = buf.getInt()
+      if (keyLength < 0 || keyLength > buf.remaining() - (MinEntrySize - 4)) {
+        throw corrupted(s"key length $keyLength")
+      }
+      val key = new Array[Byte](keyLength)
+      buf.get(key)
+      val e = Entry(buf.getLong(), buf.getInt())
+      if (e.offset < HeaderSize || e.length < 0 || e.offset + e.length > indexOffset) {
+        throw corrupted(s"payload at ${e.offset} of ${e.length} bytes")
+      }
+      index(new String(key, StandardCharsets.UTF_8)) = e
+    }
+    index
+  }
+
+  private[v2] def readFully(ch: FileChannel, buf: ByteBuffer, offset: Long): Unit = {
+    var pos = offset
+    while (buf.hasRemaining()) {
+      val n = ch.read(buf, pos)
+      if (n < 0) {
+        throw new IOException("unexpected end of a UAST segment")
+      }
+      pos += n
+    }
+  }
+
+  private[v2] def writeFully(ch: FileChannel, buf: ByteBuffer): Unit = {
+    while (buf.hasRemaining()) {
+      ch.write(buf)
+    }
+  }
+}
+
+/**
+  * Appends encoded UASTs to a segment file. Not thread-safe.
+  *
+  * The index is kept in memory, and written and committed on close.
+  */
+class UastSegmentWriter private[v2](path: Path) extends Closeable {
+  import UastSegment._
+
+  private val ch = FileChannel.open(path,
+    StandardOpenOption.CREATE, StandardOpenOption.READ, StandardOpenOption.WRITE)
+  private val index = mutable.LinkedHashMap[String, Entry]()
+  private var closed = false
+
+  try {
+    if (ch.size() == 0) {
+      // nothing is committed until the first close
+      val header = ByteBuffer.allocate(HeaderSize).put(HeaderMagic).putLong(0L)
+      header.flip()
+      writeFully(ch, header)
+    } else {
+      val committed = readHeader(ch)
+      if (committed != 0) {
+        index ++= readIndex(ch, committed)
+      }
+      // drops only what was appended after the last commit
+      val start = math.max(committed, HeaderSize)
+      ch.truncate(start)
+      ch.position(start)
+    }
+  } catch {
+    case e: Throwable =>
+      ch.close()
+      throw e
+  }
+
+  /** Appends the remaining bytes of an encoded UAST under a given key */
+  def append(key: String, payload: ByteBuffer): Unit = {
+    require(!closed, "segment is closed")
+    val offset = ch.position()
+    val src = payload.duplicate()
+    val length = src.remaining()
+    writeFully(ch, src)
+    index(key) = Entry(offset, length)
+  }
+
+  /** Encodes the whole tree of a given context and appends it under a given key */
+  def append(key: String, ctx: ContextExt): Unit = {
+    val pool = BufferPool.default
+    val buf = ctx.encode(ctx.root(), BblfshClient.UastBinary, pool)
+    try {
+      append(key, buf)
+    } finally {
+      pool.release(buf)
+    }
+  }
+
+  /** Writes and commits the index, and closes the file. Idempotent. */
+  override def close(): Unit = {
+    if (closed) {
+      return
+    }
+    closed = true
+
+    try {
+      val indexOffset = ch.position()
+      val buf = ByteBuffer.allocate((indexBytes(index) + TrailerSize).toInt)
+      for ((key, e) <- index) {
+        val k = key.getBytes(StandardCharsets.UTF_8)
+        buf.putInt(k.length).put(k).putLong(e.offset).putInt(e.length)
+      }
+      buf.putLong(indexOffset).putInt(index.size).put(TrailerMagic)
+      buf.flip()
+      writeFully(ch, buf)
+      ch.force(false)
+
+      // commits the new index only once it is on disk
+      val committed = ByteBuffer.allocate(8).putLong(ch.position())
+      committed.flip()
+      while (committed.hasRemaining()) {
+        ch.write(committed, HeaderMagic.length + committed.position())
+      }
+      ch.force(true)
+    } finally {
+      ch.close()
+    }
+  }
+
+  private def indexBytes(index: collection.Map[String, Entry]): Long = {
+    index.keys.map(k => 4L + k.getBytes(StandardCharsets.UTF_8).length + 8 + 4).sum
+  }
+}
+
+/**
+  * Reads encoded UASTs from a segment file. Safe to use from multiple threads.
+  *
+  * Opening reads only the index. Each payload is memory-mapped on access, so
+  * it is decoded from the mapped Direct buffer without copying, and only the
+  * pages it spans are read from disk.
+  */
+class UastSegmentReader private[v2](path: Path) extends Closeable {
+  import UastSegment._
+
+  private val ch = FileChannel.open(path, StandardOpenOption.READ)
+  private val index = try {
+    readIndex(ch, readHeader(ch))
+  } catch {
+    case e: Throwable =>
+      ch.close()
+      throw e
+  }
+
+  /** Keys of all the payloads, in the order they were first appended */
+  def keys: Iterable[String] = index.keys
+
+  def size: Int = index.size
+
+  def contains(key: String): Boolean = index.contains(key)
+
+  /**
+    * Returns the encoded UAST under a given key, as a read-only mapped buffer.
+    * The mapping stays valid after the reader is closed.
+    */
+  def get(key: String): Option[ByteBuffer] = {
+    index.get(key).map { e =>
+      ch.map(FileChannel.MapMode.READ_ONLY, e.offset, e.length)
+    }
+  }
+
+  /** Decodes the UAST under a given key straight from the mapped file */
+  def decode(key: String): Option[ContextExt] = {
+    get(key).map(BblfshClient.decode(_, BblfshClient.UastBinary))
+  }
+
+  override def close(): Unit = {
+    ch.close()
+  }
+}
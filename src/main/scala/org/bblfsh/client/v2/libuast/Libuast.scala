@@ -1,6 +1,6 @@
 package org.bblfsh.client.v2.libuast
 
-import org.bblfsh.client.v2.{ContextExt, Context, JNode, NodeExt}
+import org.bblfsh.client.v2.{ContextExt, Context, JNode, NativeCleaner, NodeExt}
 import org.bblfsh.client.v2.libuast.Libuast.UastIterExt
 
 import scala.collection.Iterator
@@ -37,18 +37,34 @@ object Libuast {
     *
     * It brides the gap between the contracts of a Scala iterator (.hasNext()/.next()) and
     * a native Libuast iterator (.next() == null at the end).
+    *
+    * Nodes are fetched from the native side in batches of up to [[UastAbstractIter.BatchSize]],
+    * to make a single JNI call per batch instead of one per node.
+    *
+    * Native memory is freed by close(), at the end of the iteration, or once
+    * the iterator is unreachable.
     **/
   abstract class UastAbstractIter[T >: Null](var node: T, var treeOrder: Int, var iter: Long)
-      extends Iterator[T] {
+      extends Iterator[T] with AutoCloseable {
     private var closed = false
+    private var cleanable: NativeCleaner.Cleanable = null
     private var nextNode: Option[T] = None
+    private val batch = new Array[AnyRef](UastAbstractIter.BatchSize)
+    private var batchPos = 0
+    private var batchLen = 0
 
     private def lookahead(): Option[T] = {
-      val node = nativeNext(iter)
-      if (node == null) {
+      if (batchPos == batchLen) {
+        batchPos = 0
+        batchLen = nativeNextBatch(iter, batch)
+      }
+      if (batchLen == 0) {
         close()
         None
       } else {
+        val node = batch(batchPos).asInstanceOf[T]
+        batch(batchPos) = null
+        batchPos += 1
         Some(node)
       }
     }
@@ -71,34 +87,54 @@ object Libuast {
       null
     }
 
-    def close() = {
+    /** Frees the native iterator. Idempotent */
+    override def close(): Unit = synchronized {
       if (!closed) {
+        if (cleanable != null) {
+          cleanable.cancel()
+        }
         nativeDispose()
         closed = true
       }
     }
 
+    /** Registers the native iterator, once it is set, to be freed when unreachable */
+    protected def track(kind: Int): Unit = {
+      if (iter != 0 && cleanable == null) {
+        cleanable = NativeCleaner.register(this, kind, iter)
+      }
+    }
+
     def nativeNext(iterPtr: Long): T
+    /** Fills the given array with up to its length next nodes, returns their number */
+    def nativeNextBatch(iterPtr: Long, out: Array[AnyRef]): Int
     def nativeInit()
     def nativeDispose()
+  }
 
-    override def finalize(): Unit = {
-      this.nativeDispose()
-    }
+  object UastAbstractIter {
+    /** Max number of nodes fetched from the native side in one call */
+    final val BatchSize = 256
   }
 
   /** Iterator over children of the given external/native node */
   class UastIterExt(node: NodeExt, treeOrder: Int, iter: Long, var ctx: ContextExt)
     extends UastAbstractIter(node, treeOrder, iter) {
+    track(NativeCleaner.IterExtKind)
+
+    private[libuast] def track(): Unit = track(NativeCleaner.IterExtKind)
+
     @native def nativeNext(iterPtr: Long): NodeExt
+    @native def nativeNextBatch(iterPtr: Long, out: Array[AnyRef]): Int
     @native def nativeInit()
     @native def nativeDispose()
   }
 
   object UastIterExt {
     def apply(node: NodeExt, treeOrder: Int): UastIterExt = {
-      val it = new UastIterExt(node, treeOrder, 0, ContextExt(0))
+      val it = new UastIterExt(node, treeOrder, 0, new ContextExt(0))
       it.nativeInit()
+      it.track()
       it
     }
   }
@@ -106,15 +142,21 @@ object Libuast {
   /** Iterator over children of the given managed node */
   class UastIter(node: JNode, treeOrder: Int, iter: Long, var ctx: Context)
     extends UastAbstractIter(node, treeOrder, iter) {
+    track(NativeCleaner.IterKind)
+
+    private[libuast] def track(): Unit = track(NativeCleaner.IterKind)
+
     @native def nativeNext(iterPtr: Long): JNode
+    @native def nativeNextBatch(iterPtr: Long, out: Array[AnyRef]): Int
     @native def nativeInit()
     @native def nativeDispose()
   }
 
   object UastIter {
     def apply(node: JNode, treeOrder: Int): UastIter = {
-      val it = new UastIter(node, treeOrder, 0, Context(0))
+      val it = new UastIter(node, treeOrder, 0, new Context(0))
       it.nativeInit()
+      it.track()
       it
     }
   }
@@ -155,6 +197,15 @@ class Libuast {
     */
   @native def decode(buf: ByteBuffer, fmt: Int): ContextExt
 
+  /**
+    * Decode UASTs from the first lens(i) bytes of many direct buffers, on up
+    * to the given number of native threads
+    */
+  @native def decodeAll(bufs: Array[ByteBuffer], lens: Array[Int], fmt: Int, parallelism: Int): Array[ContextExt]
+
+  /** Decode UAST from a range of a heap byte array, with no JVM-side copies */
+  @native def decodeBytes(bytes: Array[Byte], offset: Int, len: Int, fmt: Int): ContextExt
+
   /** Lifts the tree order values from the libuast */
   @native def getTreeOrders: Libuast.TreeOrder
 
@@ -0,0 +1,40 @@
+package org.bblfsh.client.v2
+
+import java.util.concurrent.{Callable, Executors, TimeUnit}
+
+import scala.collection.JavaConverters._
+
+
+class BblfshClientConcurrencyTest extends BblfshClientBaseTest {
+
+  import BblfshClient._ // enables uast.* methods
+
+  val threads = 8
+  val rounds = 50
+
+  def decodeAndFilter(): Int = {
+    val ctx = resp.uast.decode()
+    val it = ctx.filter("//uast:Identifier")
+    val count = it.size
+    it.close()
+    ctx.dispose()
+    count
+  }
+
+  "Decoding and filtering from multiple threads" should "give the same results as from one" in {
+    val expected = decodeAndFilter()
+    for (_ <- 0 until rounds) decodeAndFilter() shouldBe expected
+
+    val pool = Executors.newFixedThreadPool(threads)
+    val tasks = (0 until threads * rounds).map { _ =>
+      new Callable[Int] { def call(): Int = decodeAndFilter() }
+    }
+    val results = pool.invokeAll(tasks.asJava).asScala.map(_.get())
+    pool.shutdown()
+    pool.awaitTermination(1, TimeUnit.MINUTES)
+
+    results should have size (threads * rounds)
+    all (results) shouldBe expected
+  }
+
+}
@@ -2,6 +2,8 @@ package org.bblfsh.client.v2
 
 import java.nio.ByteBuffer
 
+import scala.io.Source
+
 
 class BblfshClientLoadTest extends BblfshClientBaseTest {
 
@@ -74,4 +76,69 @@ class BblfshClientLoadTest extends BblfshClientBaseTest {
     root2 should equal (root)
   }
 
+  "Loading Go -> JVM of a large tree" should "not overflow local references" in {
+    val largeFileName = "src/test/resources/large.php"
+    val largeContent = Source.fromFile(largeFileName).getLines.mkString("\n")
+    val largeResp = client.parse(largeFileName, largeContent)
+
+    val ctx = largeResp.uast.decode()
+    val root = ctx.root().load()
+    val nodes = ctx.count("//*")
+    ctx.dispose()
+
+    root shouldBe a [JObject]
+    root.children should not be empty
+
+    // libuast reads the managed tree through per-node JNI upcalls
+    val managed = Context()
+    val it = managed.filter("//*", root)
+    it.size shouldBe nodes
+    it.close()
+    managed.close()
+  }
+
+  "Viewing Go -> JVM of a real tree" should "expand nodes the same as loading" in {
+    val uast = resp.uast.decode()
+    val root = uast.root()
+    val view = root.view()
+    val loaded = root.load()
+    uast.dispose()
+
+    view shouldBe a [JLazy]
+    view.kind shouldBe JNode.Kind.Object
+    view.children(1) shouldBe a [JLazy]
+    view shouldEqual loaded
+    loaded shouldEqual view
+    view.hashCode shouldBe loaded.hashCode
+  }
+
+  "Viewing Go -> JVM of a real tree" should "reject handles of other nodes" in {
+    val uast = resp.uast.decode()
+    val view = uast.root().view().asInstanceOf[JLazy]
+    uast.dispose()
+
+    a [RuntimeException] should be thrownBy view.ctx.expand(42L)
+    view.size should be > 0
+    view.ctx.close()
+  }
+
+  "Reading a flat UAST" should "fail on an unknown node kind" in {
+    val unknownKind = Array[Byte](0, 0, 0, 0, 42)
+    a [RuntimeException] should be thrownBy JNode.readFlat(unknownKind)
+  }
+
+  "Loading Go -> JVM of a real tree" should "share a single JNull" in {
+    def nulls(n: JNode): Seq[JNode] = n match {
+      case _: JNull => Seq(n)
+      case _ => n.children.flatMap(nulls)
+    }
+
+    val uast = resp.uast.decode()
+    val found = nulls(uast.root().load())
+    uast.dispose()
+
+    found should not be empty
+    found.foreach(_ should be theSameInstanceAs found.head)
+  }
+
 }
@@ -1,5 +1,6 @@
 package org.bblfsh.client.v2
 
+import java.io.ByteArrayOutputStream
 import java.nio.ByteBuffer
 import scala.io.Source
 
@@ -90,6 +91,104 @@ class BblfshClientParseTest extends BblfshClientBaseTest {
     ctx.root().load() shouldEqual decoded.root().load()
   }
 
+  "Streaming encode" should "write the same bytes as encode in chunks" in {
+    val ctx: ContextExt = resp.uast.decode()
+    val expected = ctx.encode(ctx.root(), UastBinary)
+    val bytes = new Array[Byte](expected.remaining())
+    expected.get(bytes)
+
+    var chunks = 0
+    val out = new ByteArrayOutputStream()
+    val sink = new ChunkSink(1000) {
+      override protected def write(chunk: ByteBuffer): Unit = {
+        chunk.remaining() should be <= 1000
+        chunks += 1
+        val b = new Array[Byte](chunk.remaining())
+        chunk.get(b)
+        out.write(b)
+      }
+    }
+    ctx.encodeTo(ctx.root(), UastBinary, sink)
+    out.toByteArray should equal (bytes)
+    chunks shouldBe (bytes.length + 999) / 1000
+
+    val stream = new ByteArrayOutputStream()
+    ctx.encodeTo(ctx.root(), UastBinary, stream)
+    stream.toByteArray should equal (bytes)
+
+    val tree = ctx.root().load()
+    val managed = new ByteArrayOutputStream()
+    Context().encodeTo(tree, UastBinary, managed)
+    managed.toByteArray should equal (tree.toByteArray)
+  }
+
+  "BblfshClient.decode" should "decode heap arrays and buffers the same as direct buffers" in {
+    val bytes = resp.uast.toByteArray
+    val direct = ByteBuffer.allocateDirect(bytes.length)
+    direct.put(bytes)
+    direct.flip()
+
+    val expected = BblfshClient.decode(direct).root().load()
+    BblfshClient.decode(bytes, UastBinary).root().load() shouldEqual expected
+    BblfshClient.decode(ByteBuffer.wrap(bytes)).root().load() shouldEqual expected
+
+    val padded = Array[Byte](1, 2) ++ bytes
+    BblfshClient.decode(padded, 2, bytes.length, UastBinary).root().load() shouldEqual expected
+  }
+
+  "BblfshClient.decode" should "read heap buffers only up to their limit" in {
+    val bytes = resp.uast.toByteArray
+    val expected = BblfshClient.decode(bytes, UastBinary).root().load()
+
+    val spare = ByteBuffer.allocate(bytes.length + 16)
+    spare.put(bytes)
+    spare.put(Array.fill[Byte](16)(7))
+    spare.flip()
+    spare.limit(bytes.length)
+    BblfshClient.decode(spare).root().load() shouldEqual expected
+
+    val padded = ByteBuffer.wrap(Array[Byte](1, 2) ++ bytes ++ Array[Byte](3))
+    padded.position(2)
+    val sliced = padded.slice()
+    sliced.limit(bytes.length)
+    BblfshClient.decode(sliced).root().load() shouldEqual expected
+  }
+
+  "BblfshClient.decodeAll" should "decode all buffers in input order" in {
+    val bytes = resp.uast.toByteArray
+    val direct = ByteBuffer.allocateDirect(bytes.length)
+    direct.put(bytes)
+    direct.flip()
+    val empty = JArray(JString("test")).toByteBuffer
+
+    val bufs = Seq(direct, ByteBuffer.wrap(bytes), empty, direct)
+    val ctxs = BblfshClient.decodeAll(bufs, UastBinary, 2)
+
+    val expected = BblfshClient.decode(direct).root().load()
+    ctxs should have size (4)
+    ctxs(0).root().load() shouldEqual expected
+    ctxs(1).root().load() shouldEqual expected
+    ctxs(2).root().load() shouldEqual JArray(JString("test"))
+    ctxs(3).root().load() shouldEqual expected
+    ctxs.foreach(_.dispose())
+  }
+
+  "BblfshClient.decodeAll" should "read heap buffers only up to their limit" in {
+    val bytes = resp.uast.toByteArray
+    val spare = ByteBuffer.allocate(bytes.length + 16)
+    spare.put(bytes)
+    spare.put(Array.fill[Byte](16)(7))
+    spare.flip()
+    spare.limit(bytes.length)
+
+    val ctxs = BblfshClient.decodeAll(Seq(spare, spare), UastBinary, 2)
+    val expected = BblfshClient.decode(bytes, UastBinary).root().load()
+    ctxs.foreach { ctx =>
+      ctx.root().load() shouldEqual expected
+      ctx.dispose()
+    }
+  }
+
   "BblfshClient.decode with invalid number" should "use binary format" in {
     val invalidNumDec = resp.uast.decode(-1)
     val binaryDecoded = resp.uast.decode(UastBinary)
@@ -0,0 +1,150 @@
+package org.bblfsh.client.v2
+
+import java.lang.management.ManagementFactory
+import java.util.concurrent.{Callable, Executors, TimeUnit}
+
+import gopkg.in.bblfsh.sdk.v2.protocol.driver.ParseResponse
+
+import scala.collection.JavaConverters._
+import scala.io.Source
+
+/**
+  * Timings and heap allocations of the native paths, that the tests do not
+  * assert on.
+  *
+  * Needs a bblfshd on localhost:9432, the same as the tests. Run with
+  *
+  *   ./sbt "test:runMain org.bblfsh.client.v2.Benchmarks [iterations]"
+  *
+  * and add -Xcheck:jni to the JVM options to also get warnings about local
+  * references that are not freed.
+  */
+object Benchmarks {
+
+  import BblfshClient._ // enables uast.* methods
+
+  val largeFileName = "src/test/resources/large.php"
+  val sampleFileName = "src/test/resources/SampleJavaFile.java"
+
+  def main(args: Array[String]): Unit = {
+    val iterations = if (args.nonEmpty) args(0).toInt else 20
+    val client = BblfshClient("localhost", 9432)
+    try {
+      val large = parse(client, largeFileName)
+      loadLarge(large, iterations)
+
+      val sample = parse(client, sampleFileName)
+      for (threads <- Seq(1, 2, 4, 8)) {
+        decodeAndFilter(sample, threads, iterations)
+      }
+    } finally {
+      client.close()
+    }
+  }
+
+  def parse(client: BblfshClient, fileName: String): ParseResponse = {
+    val content = Source.fromFile(fileName).getLines.mkString("\n")
+    client.parse(fileName, content)
+  }
+
+  /** Median wall time of the given code in milliseconds, after a warm-up run */
+  def medianMs(iterations: Int)(f: => Unit): Double = {
+    f
+    val times = (0 until iterations).map { _ =>
+      val start = System.nanoTime()
+      f
+      (System.nanoTime() - start) / 1e6
+    }.sorted
+    times(times.size / 2)
+  }
+
+  /**
+    * Median number of bytes allocated on the JVM heap by the current thread
+    * while running the given code, after a warm-up run. Native memory is not
+    * counted. Needs a HotSpot JVM.
+    */
+  def medianAllocatedBytes(iterations: Int)(f: => Unit): Long = {
+    val mx = ManagementFactory.getThreadMXBean.asInstanceOf[com.sun.management.ThreadMXBean]
+    val thread = Thread.currentThread().getId
+    f
+    val bytes = (0 until iterations).map { _ =>
+      val start = mx.getThreadAllocatedBytes(thread)
+      f
+      mx.getThreadAllocatedBytes(thread) - start
+    }.sorted
+    bytes(bytes.size / 2)
+  }
+
+  def report(name: String, value: String): Unit = {
+    println(f"$name%-48s $value")
+  }
+
+  /**
+    * Loads a large tree to the JVM, and filters it through per-node upcalls.
+    *
+    * The timings are only meaningful against a run of the same build without
+    * the scoped local reference frames, on the same machine; no such baseline
+    * is kept in the tree. The native memory of the upcalls is not reported,
+    * watch the resident size of the JVM for it.
+    *
+    * The bytes allocated by the managed filter are mostly the JVM tree built
+    * back by libuast. They are expected to be about one object per node (and
+    * the buffers of objects and arrays), with no JNull per null value.
+    */
+  def loadLarge(resp: ParseResponse, iterations: Int): Unit = {
+    val ctx = resp.uast.decode()
+    val root = ctx.root().load()
+
+    def load(): Unit = ctx.root().load()
+    def filter(): Unit = {
+      val managed = Context()
+      val it = managed.filter("//*", root)
+      it.size
+      it.close()
+      managed.close()
+    }
+
+    val loadMs = medianMs(iterations)(load())
+    val loadBytes = medianAllocatedBytes(iterations)(load())
+    val filterMs = medianMs(iterations)(filter())
+    val filterBytes = medianAllocatedBytes(iterations)(filter())
+
+    report(s"load $largeFileName", f"$loadMs%.2f ms, ${loadBytes / 1024}%d KiB allocated")
+    report(s"managed filter //* of $largeFileName", f"$filterMs%.2f ms, ${filterBytes / 1024}%d KiB allocated")
+    ctx.close()
+  }
+
+  /**
+    * Decodes and filters the same tree on a number of threads, to see how
+    * the per-context locking scales. Each round runs one decode and filter
+    * per thread.
+    *
+    * Scaling is near linear if ops/s grows with the number of threads, up to
+    * the number of cores; the run only goes up to 8 threads, and bblfshd is
+    * not involved once the tree is parsed.
+    */
+  def decodeAndFilter(resp: ParseResponse, threads: Int, iterations: Int): Unit = {
+    val rounds = 50
+    val pool = Executors.newFixedThreadPool(threads)
+    val task = new Callable[Int] {
+      def call(): Int = {
+        val ctx = resp.uast.decode()
+        val it = ctx.filter("//uast:Identifier")
+        val n = it.size
+        it.close()
+        ctx.close()
+        n
+      }
+    }
+    val tasks = Seq.fill(threads * rounds)(task).asJava
+
+    val ms = medianMs(iterations) {
+      pool.invokeAll(tasks).asScala.foreach(_.get())
+    }
+    pool.shutdown()
+    pool.awaitTermination(1, TimeUnit.MINUTES)
+
+    val perSecond = threads * rounds / (ms / 1000)
+    report(s"decode+filter of $sampleFileName, $threads threads", f"$perSecond%.0f ops/s")
+  }
+}
@@ -0,0 +1,69 @@
+package org.bblfsh.client.v2
+
+import java.nio.{ByteBuffer, ByteOrder}
+
+import org.scalatest.{FlatSpec, Matchers}
+
+class BufferPoolTest extends FlatSpec
+  with Matchers {
+
+  "BufferPool" should "hand out direct buffers limited to the requested size" in {
+    val pool = new BufferPool()
+    val buf = pool.acquire(5000)
+
+    buf.isDirect shouldBe true
+    buf.position shouldBe 0
+    buf.limit shouldBe 5000
+    buf.capacity shouldBe 8192
+  }
+
+  "BufferPool" should "reuse released buffers of the same size class" in {
+    val pool = new BufferPool()
+    val buf = pool.acquire(100)
+    pool.release(buf)
+    pool.retained shouldBe BufferPool.MinClassSize
+
+    pool.acquire(200) should be theSameInstanceAs buf
+    pool.retained shouldBe 0
+  }
+
+  "BufferPool" should "reset the byte order of reused buffers" in {
+    val pool = new BufferPool()
+    val buf = pool.acquire(100)
+    buf.order(ByteOrder.LITTLE_ENDIAN)
+    pool.release(buf)
+
+    pool.acquire(100).order shouldBe ByteOrder.BIG_ENDIAN
+  }
+
+  "BufferPool" should "not retain more than the limit" in {
+    val pool = new BufferPool(BufferPool.MinClassSize)
+    val a = pool.acquire(10)
+    val b = pool.acquire(10)
+    pool.release(a)
+    pool.release(b)
+
+    pool.retained shouldBe BufferPool.MinClassSize
+  }
+
+  "Unpooled BufferPool" should "allocate buffers of the exact size" in {
+    val buf = BufferPool.Unpooled.acquire(5000)
+
+    buf.capacity shouldBe 5000
+    BufferPool.Unpooled.release(buf)
+    BufferPool.Unpooled.retained shouldBe 0
+  }
+
+  "ChunkSink" should "return its chunk to the pool once closed" in {
+    val pool = new BufferPool()
+    val sink = new ChunkSink(5000, pool) {
+      override protected def write(chunk: ByteBuffer): Unit = {}
+    }
+
+    sink.chunk.capacity shouldBe 5000
+    sink.close()
+    sink.close()
+    pool.retained shouldBe 8192
+  }
+
+}
@@ -23,4 +23,28 @@ class ContextExtTest extends FlatSpec
     client.close()
   }
 
+  "ContextExt" should "be closed by withContext and keep its iterators usable" in {
+    val client = BblfshClient("localhost", 9432)
+    val fileName = "src/test/resources/SampleJavaFile.java"
+    val fileContent = Source.fromFile(fileName).getLines.mkString("\n")
+    val resp = client.parse(fileName, fileContent)
+
+    import BblfshClient._ // enables uast.* methods
+
+    var closed: ContextExt = null
+    val it = resp.uast.withContext { ctx =>
+      closed = ctx
+      ctx.filter("//uast:Position")
+    }
+    closed.nativeContext shouldBe 0
+    closed.close()
+
+    // the iterator keeps the native tree alive until it is closed
+    it.hasNext() shouldBe true
+    it.close()
+    it.close()
+
+    client.close()
+  }
+
 }
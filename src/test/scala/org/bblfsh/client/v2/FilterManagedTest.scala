@@ -83,4 +83,19 @@ class FilterManagedTest extends BblfshClientBaseTest {
     iter.close()
   }
 
+  "Filtering UAST" should "find the same nodes with reused contexts" in {
+    val fileContent = Source.fromFile(fileName).getLines.mkString("\n")
+    val resp = client.parse(fileName, fileContent, Mode.SEMANTIC)
+    val node = resp.get
+
+    val expected = BblfshClient.filter(node, "//uast:Identifier").toList
+    for (_ <- 0 until 50) {
+      val iter = BblfshClient.filter(node, "//uast:Identifier")
+      val ctx = iter.ctx
+      iter.toList should equal (expected)
+      iter.close()
+      ctx.close()
+    }
+  }
+
 }
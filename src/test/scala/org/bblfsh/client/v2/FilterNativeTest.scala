@@ -42,4 +42,85 @@ class FilterNativeTest extends FlatSpec
     pos should have size (8)  // Tiny.java contains 8 nodes with position
   }
 
+  "XPath filter" should "find the same nodes by handles" in {
+    val handles = nativeRootCtx.filterHandles("//uast:Position")
+    handles should have size (8)
+
+    val nodes = nativeRootCtx.filter("//uast:Position").toList
+    handles.map(nativeRootCtx.node).toList should equal (nodes)
+  }
+
+  "Prepared XPath filter" should "find the same nodes as the query text" in {
+    val query = PreparedQuery("//uast:Position")
+
+    nativeRootCtx.filter(query).toList should equal (nativeRootCtx.filter("//uast:Position").toList)
+    nativeRootCtx.root().filter(query).toList should have size (8)
+    nativeRootCtx.filterHandles(query) should have size (8)
+    query.dispose()
+  }
+
+  "Prepared XPath queries" should "be cached by the query text" in {
+    PreparedQuery.cached("//uast:Position") should be theSameInstanceAs
+      PreparedQuery.cached("//uast:Position")
+  }
+
+  "Cached XPath queries" should "stay usable after close" in {
+    val query = PreparedQuery.cached("//uast:Position")
+    query.close()
+    nativeRootCtx.count(PreparedQuery.cached("//uast:Position")) shouldBe 8
+
+    val own = PreparedQuery("//uast:Position")
+    own.close()
+    a[RuntimeException] should be thrownBy nativeRootCtx.count(own)
+  }
+
+  "Multiple XPath filters" should "find the same nodes as one by one" in {
+    val queries = Seq("//uast:Position", "//uast:Identifier", "//*[@role='Nonexistent']")
+    val results = nativeRootCtx.filterMany(queries)
+
+    results should have size (3)
+    results(0) should have size (8)
+    for ((query, handles) <- queries.zip(results)) {
+      handles.toList should equal (nativeRootCtx.filterHandles(query).toList)
+    }
+  }
+
+  "Native aggregations" should "match the filter results" in {
+    nativeRootCtx.count("//uast:Position") shouldBe 8
+    nativeRootCtx.root().count("//uast:Position") shouldBe 8
+    nativeRootCtx.exists("//uast:Position") shouldBe true
+    nativeRootCtx.exists("//*[@role='Nonexistent']") shouldBe false
+  }
+
+  "Native countBy" should "group nodes by type" in {
+    val types = nativeRootCtx.countBy("@type")
+
+    types("uast:Position") shouldBe 8
+    types.values.sum shouldBe nativeRootCtx.count("//*[@type]")
+    nativeRootCtx.root().countBy("@type") should equal (types)
+  }
+
+  "Columnar export" should "have a row per node in pre-order" in {
+    val cols = nativeRootCtx.toColumns()
+    val types = nativeRootCtx.countBy("@type")
+
+    // positions are folded into their owner rows
+    cols.rows shouldBe types.values.sum - types("uast:Position") - types.getOrElse("uast:Positions", 0L)
+    cols.parent.get(0) shouldBe -1
+    cols.depth.get(0) shouldBe 0
+    cols.string(cols.typeId.get(0)) shouldBe nativeRootCtx.root().load()("@type").asInstanceOf[JString].str
+    for (row <- 1 until cols.rows) {
+      cols.parent.get(row) should be < row
+      cols.depth.get(row) shouldBe cols.depth.get(cols.parent.get(row)) + 1
+    }
+    (0 until cols.rows).exists(cols.startOffset.get(_) >= 0) shouldBe true
+  }
+
+  "Handle iterator" should "visit the same nodes as the iterator" in {
+    val handles = nativeRootCtx.iterateHandles(BblfshClient.PreOrder)
+
+    val nodes = BblfshClient.iterator(nativeRootCtx.root(), BblfshClient.PreOrder).toList
+    handles.toList should equal (nodes.map(_.handle))
+  }
+
 }
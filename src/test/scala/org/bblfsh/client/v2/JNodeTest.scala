@@ -53,6 +53,33 @@ class JNodeTest extends FlatSpec
     obj("k2") shouldBe JBool(false)
   }
 
+  "JNode" should "expose kind" in {
+    rootTree.kind shouldEqual JNode.Kind.Array
+    rootTree.children(0).kind shouldEqual JNode.Kind.Object
+    rootTree.children(1).kind shouldEqual JNode.Kind.String
+    JNull().kind shouldEqual JNode.Kind.Null
+    JInt(1).kind shouldEqual JNode.Kind.Int
+    JUint(1).kind shouldEqual JNode.Kind.Uint
+    JFloat(1.0).kind shouldEqual JNode.Kind.Float
+    JBool(true).kind shouldEqual JNode.Kind.Bool
+  }
+
+  "JNode" should "round-trip through the flat layout" in {
+    val tree = JObject(
+      "k1" -> rootTree,
+      "k2" -> JInt(-1),
+      "k3" -> JFloat(0.5),
+      "k4" -> JNull(),
+      "k1" -> JString("v1")
+    )
+
+    val buf = JNode.writeFlat(tree, BufferPool.Unpooled)
+    val bytes = new Array[Byte](buf.remaining())
+    buf.get(bytes)
+
+    JNode.readFlat(bytes) shouldEqual tree
+  }
+
   "JNode object and array" should "expose add" in {
     // object
     val obj = rootTree.children(0).asInstanceOf[JObject]
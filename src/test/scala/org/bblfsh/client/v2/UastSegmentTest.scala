@@ -0,0 +1,124 @@
+package org.bblfsh.client.v2
+
+import java.io.IOException
+import java.nio.ByteBuffer
+import java.nio.file.{Files, Path, StandardOpenOption}
+
+class UastSegmentTest extends BblfshClientBaseTest {
+
+  import BblfshClient._
+
+  var path: Path = _
+
+  override def beforeEach() = {
+    super.beforeEach()
+    path = Files.createTempFile("uast", ".seg")
+    Files.delete(path)
+  }
+
+  override def afterEach() = {
+    Files.deleteIfExists(path)
+  }
+
+  private def bytes(buf: ByteBuffer): Array[Byte] = {
+    val res = new Array[Byte](buf.remaining())
+    buf.duplicate().get(res)
+    res
+  }
+
+  "UastSegment" should "read back the appended payloads" in {
+    val w = UastSegment.writer(path)
+    w.append("a", ByteBuffer.wrap(Array[Byte](1, 2, 3)))
+    w.append("b", ByteBuffer.wrap(Array[Byte](4, 5)))
+    w.close()
+
+    val r = UastSegment.open(path)
+    r.keys.toList should equal (List("a", "b"))
+    bytes(r.get("a").get) should equal (Array[Byte](1, 2, 3))
+    bytes(r.get("b").get) should equal (Array[Byte](4, 5))
+    r.get("c") shouldBe None
+    r.close()
+  }
+
+  "UastSegment" should "keep the old payloads when appending to it again" in {
+    val w1 = UastSegment.writer(path)
+    w1.append("a", ByteBuffer.wrap(Array[Byte](1)))
+    w1.close()
+
+    val w2 = UastSegment.writer(path)
+    w2.append("b", ByteBuffer.wrap(Array[Byte](2)))
+    w2.append("a", ByteBuffer.wrap(Array[Byte](3)))
+    w2.close()
+
+    val r = UastSegment.open(path)
+    r.size shouldBe 2
+    bytes(r.get("a").get) should equal (Array[Byte](3))
+    bytes(r.get("b").get) should equal (Array[Byte](2))
+    r.close()
+  }
+
+  "UastSegment" should "not open a segment that was never closed" in {
+    val header = ByteBuffer.allocate(UastSegment.HeaderSize)
+    header.put(UastSegment.HeaderMagic).putLong(0L)
+    Files.write(path, header.array() ++ Array[Byte](1, 2, 3))
+
+    an [IOException] should be thrownBy UastSegment.open(path)
+  }
+
+  "UastSegment" should "keep the committed payloads after an unfinished append" in {
+    val w1 = UastSegment.writer(path)
+    w1.append("a", ByteBuffer.wrap(Array[Byte](1)))
+    w1.close()
+
+    // what a writer that crashed before close leaves behind
+    Files.write(path, Array[Byte](9, 9, 9), StandardOpenOption.APPEND)
+
+    val r1 = UastSegment.open(path)
+    r1.keys.toList should equal (List("a"))
+    r1.close()
+
+    val w2 = UastSegment.writer(path)
+    w2.append("b", ByteBuffer.wrap(Array[Byte](2)))
+    w2.close()
+
+    val r2 = UastSegment.open(path)
+    bytes(r2.get("a").get) should equal (Array[Byte](1))
+    bytes(r2.get("b").get) should equal (Array[Byte](2))
+    r2.close()
+  }
+
+  "UastSegment" should "reject an index that is out of bounds" in {
+    val w = UastSegment.writer(path)
+    w.append("a", ByteBuffer.wrap(Array[Byte](1)))
+    w.close()
+
+    val data = Files.readAllBytes(path)
+    val committed = ByteBuffer.wrap(data).getLong(UastSegment.HeaderMagic.length).toInt
+    val trailer = committed - UastSegment.TrailerSize
+    val indexOffset = ByteBuffer.wrap(data).getLong(trailer).toInt
+
+    val hugeCount = data.clone()
+    ByteBuffer.wrap(hugeCount).putInt(trailer + 8, Int.MaxValue)
+    Files.write(path, hugeCount)
+    an [IOException] should be thrownBy UastSegment.open(path)
+
+    val negativeKey = data.clone()
+    ByteBuffer.wrap(negativeKey).putInt(indexOffset, -1)
+    Files.write(path, negativeKey)
+    an [IOException] should be thrownBy UastSegment.open(path)
+  }
+
+  "UastSegment" should "decode a stored tree from the mapped file" in {
+    val ctx = resp.uast.decode()
+    val w = UastSegment.writer(path)
+    w.append(fileName, ctx)
+    w.close()
+
+    val r = UastSegment.open(path)
+    r.get(fileName).get.isDirect shouldBe true
+    val stored = r.decode(fileName).get
+    stored.root().load() should equal (ctx.root().load())
+    r.close()
+  }
+
+}
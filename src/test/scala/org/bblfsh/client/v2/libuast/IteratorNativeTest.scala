@@ -49,6 +49,17 @@ class IteratorNativeTest extends FlatSpec
     iter.iter should be(0)
   }
 
+  "Native UAST iterator" should "return the same nodes in batches as one by one" in {
+    val batched = iter.toList
+
+    val single = BblfshClient.iterator(nativeRootNode, BblfshClient.PreOrder)
+    val nodes = Iterator.continually(single.nativeNext(single.iter)).takeWhile(_ != null).toList
+    single.close()
+
+    batched shouldNot be(empty)
+    batched should equal (nodes)
+  }
+
   def countNodes(root: JNode): Int = {
       var total = 0
       root match {